@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <tuple>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
@@ -29,7 +30,5 @@ typedef std::unordered_map<gene_id, geneset> gene_to_geneset;
 typedef std::vector<std::vector<float>> gene_to_floats;
 typedef std::vector<std::vector<uint16_t>> gene_to_shorts;
 
-// used for network storage
-typedef std::unordered_map<gene_id, float> gene_to_float;
-typedef std::unordered_map<gene_id, gene_to_float>
-    gene_to_gene_to_float;
+// used for network storage: (regulator, target, MI); see CSRNetwork
+typedef std::tuple<gene_id, gene_id, float> network_edge;
@@ -2,19 +2,81 @@
 
 #include "ARACNe3.hpp"
 #include <random>
+#include <type_traits>
 #include <vector>
 
-typedef struct {
-  const float x_bound1, y_bound1, width;
-  uint16_t *const pts, num_pts, tot_num_pts;
-} square;
-
 std::vector<uint16_t> rankIndices(const std::vector<float> &vec,
                                    std::mt19937 &rand);
 
+/*
+ APMI estimator policies.  A policy supplies the chi-square threshold
+ (q_thresh) above which a cell is split and the minimum number of points
+ (size_thresh) a cell needs to be split at all.  apmi_default_policy makes the
+ standard thresholds compile-time constants, so the tessellation is specialized
+ for them; apmi_runtime_policy takes any values, for experiments.  The
+ functions taking q_thresh and size_thresh use the default policy whenever they
+ are given the default values.
+ */
+struct apmi_default_policy {
+  static constexpr float q_thresh = 7.815f;
+  static constexpr uint16_t size_thresh = 4U;
+};
+
+struct apmi_runtime_policy {
+  float q_thresh;
+  uint16_t size_thresh;
+};
+
+// Keeps the policy templates out of overload resolution for plain thresholds
+template <typename Policy>
+using apmi_policy_t = std::enable_if_t<std::is_class<Policy>::value, int>;
+
 float calcAPMI(const std::vector<float> &x_vec, const std::vector<float> &y_vec,
                const float q_thresh = 7.815, const uint16_t size_thresh = 4);
 
+float calcAPMI(const std::vector<uint16_t> &x_ranks,
+               const std::vector<uint16_t> &y_ranks,
+               const float q_thresh = 7.815, const uint16_t size_thresh = 4);
+
+template <typename Policy, apmi_policy_t<Policy> = 0>
+float calcAPMI(const std::vector<uint16_t> &x_ranks,
+               const std::vector<uint16_t> &y_ranks, const Policy &policy);
+
+float calcAPMIMorton(const std::vector<uint16_t> &x_ranks,
+                     const std::vector<uint16_t> &y_ranks,
+                     const float q_thresh = 7.815,
+                     const uint16_t size_thresh = 4);
+
+/*
+ A regulator's samples in rank order, and the screening histogram cell of each
+ rank.  Both depend only on the regulator, so they are built once and reused by
+ every calcAPMIRegulatorVsMany call for it (e.g. one per tile of targets).
+ */
+struct apmi_regulator_order {
+  std::vector<uint16_t> by_reg_rank;
+  std::vector<uint8_t> rank_cell;
+
+  apmi_regulator_order() = default;
+  explicit apmi_regulator_order(const std::vector<uint16_t> &reg_ranks);
+};
+
+std::vector<float> calcAPMIRegulatorVsMany(
+    const std::vector<uint16_t> &reg_ranks, const gene_to_shorts &ranks_mat,
+    const std::vector<gene_id> &targets, const float q_thresh = 7.815,
+    const uint16_t size_thresh = 4, uint32_t *num_screened = nullptr);
+
+template <typename Policy, apmi_policy_t<Policy> = 0>
+std::vector<float> calcAPMIRegulatorVsMany(
+    const std::vector<uint16_t> &reg_ranks, const gene_to_shorts &ranks_mat,
+    const std::vector<gene_id> &targets, const Policy &policy,
+    uint32_t *num_screened = nullptr);
+
+template <typename Policy, apmi_policy_t<Policy> = 0>
+std::vector<float> calcAPMIRegulatorVsMany(
+    const apmi_regulator_order &reg_order, const gene_to_shorts &ranks_mat,
+    const std::vector<gene_id> &targets, const Policy &policy,
+    uint32_t *num_screened = nullptr);
+
 float calcSCC(const std::vector<uint16_t> &x_ranked,
               const std::vector<uint16_t> &y_ranked);
 
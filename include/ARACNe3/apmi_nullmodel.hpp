@@ -1,23 +1,75 @@
 #pragma once
 
+#include <memory>
 #include <random>
 #include <string>
+#include <tuple>
 #include <vector>
 
+/*
+ Header of the binary null model cache, "<nulls_filename_no_extension>.bin".
+ It is followed by n_nulls floats, sorted largest to smallest, in native byte
+ order.  checksum is the 64-bit FNV-1a hash of those floats' bytes.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version, tot_num_subsample, n_nulls, size_thresh;
+  float q_thresh, m, b;
+  // alpha an adaptive model was fit for; 0 for a fixed-size model
+  float alpha;
+  uint64_t checksum;
+} null_cache_header;
+
 class APMINullModel {
 private:
   std::vector<float> null_mis;
+  // read-only mapping of the binary cache, when the nulls come from one
+  std::shared_ptr<const void> mapping;
+  // the nulls, sorted largest to smallest; in null_mis or in the mapping
+  const float *nulls;
+  uint32_t num_nulls;
+  uint16_t tot_num_subsample;
   float m, b;
+  // adaptive models stop adding batches of nulls once the fit settles
+  bool adaptive, converged;
+  float alpha;
+  uint16_t num_batches;
+  // library sizes an interpolated model lies between (0 if not interpolated),
+  // and the bound on its null MI error in the tail
+  uint16_t library_lo, library_hi;
+  float interpolation_error;
+  // MI -> p lookup table over buckets of the nulls (see buildPValTable)
+  std::vector<uint32_t> pval_table;
+  uint32_t pval_table_key_lo;
   std::string nulls_filename_no_extension, OLS_coefs_filename_no_extension;
 
+  bool mapBinaryCache(const std::string &filename,
+                      const std::string &if_invalid = "will be rebuilt");
+  bool interpolateFromLibrary(const std::string &cached_dir);
+  void buildPValTable();
+  uint32_t pValBucket(const float mi) const;
+  std::tuple<uint64_t, uint64_t, uint64_t>
+  bisectPValKeys(const float p, const float p_precise) const;
+
 public:
   APMINullModel(const APMINullModel &copied); // copy ctor
   // rand should be passed from main based on seed for predictable behavior.
   APMINullModel(const uint32_t n_nulls, const uint16_t tot_num_subsample,
-                const std::string &cached_dir, std::mt19937 &rand);
+                const std::string &cached_dir, std::mt19937 &rand,
+                const bool adaptive = false, const float alpha = 0.05f,
+                const bool from_library = false);
   ~APMINullModel();
   void cacheNullModel(const std::string cached_dir); // cache vec, m, and b
+  const std::string getDiagnostics() const; // size and tail fit, for logs
   const float
   getMIPVal(const float &mi,
             const float &p_precise = 0.001f) const; // return p value
+  const float
+  getMIThreshold(const float &p,
+                 const float &p_precise =
+                     0.001f) const; // MI above which getMIPVal(MI) < p
+  const float
+  getMIFloor(const float &p,
+             const float &p_precise =
+                 0.001f) const; // smallest MI with getMIPVal(MI) < p
 };
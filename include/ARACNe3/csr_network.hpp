@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ARACNe3.hpp"
+#include <vector>
+
+/*
+ A network in compressed sparse row (CSR) form, passed between MI computation,
+ pruning, output and consolidation.  The edges of regulator reg are the indices
+ [rowBegin(reg), rowEnd(reg)), sorted by target, with targets and MIs held in
+ parallel arrays: 6 bytes per edge, and each regulon is read sequentially.
+ Rows are indexed by gene_id; a gene past the last row has no edges.
+ */
+class CSRNetwork {
+public:
+  CSRNetwork();
+  // edges in any order, with no (regulator, target) pair twice
+  CSRNetwork(const std::vector<network_edge> &edges, const uint32_t num_rows);
+
+  uint32_t size() const { return targets.size(); }
+  uint32_t numRows() const { return offsets.size() - 1U; }
+  uint32_t rowBegin(const gene_id reg) const {
+    return reg < numRows() ? offsets[reg] : 0U;
+  }
+  uint32_t rowEnd(const gene_id reg) const {
+    return reg < numRows() ? offsets[reg + 1U] : 0U;
+  }
+  gene_id target(const uint32_t edge) const { return targets[edge]; }
+  float mi(const uint32_t edge) const { return mis[edge]; }
+
+  uint32_t find(const gene_id reg,
+                const gene_id tar) const; // edge index, or size() if absent
+  // the network without the edges set in the bitmap removed (bit e % 64 of
+  // word e / 64 for edge e)
+  CSRNetwork withoutEdges(const std::vector<uint64_t> &removed) const;
+
+private:
+  std::vector<uint32_t> offsets;
+  std::vector<gene_id> targets;
+  std::vector<float> mis;
+};
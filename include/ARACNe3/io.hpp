@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ARACNe3.hpp"
+#include "csr_network.hpp"
 #include <random>
 #include <string>
 
@@ -24,26 +25,32 @@ std::string makeUnixDirectoryNameUniversal(std::string &dir_name);
 std::string makeUnixDirectoryNameUniversal(std::string &&dir_name);
 void makeDir(const std::string &dir_name);
 
-std::tuple<const gene_to_floats, const gene_to_shorts, const geneset,
+std::tuple<const gene_to_shorts, const gene_to_shorts, const geneset,
            const uint16_t>
 readExpMatrixAndCopulaTransform(const std::string &filename,
                                 std::mt19937 &rand);
 const geneset readRegList(const std::string &filename, const bool verbose);
-gene_to_floats
-sampleExpMatAndReCopulaTransform(const gene_to_floats &exp_mat,
+gene_to_shorts
+sampleExpMatAndReCopulaTransform(const gene_to_shorts &order_mat,
                                  const uint16_t &tot_num_subsample,
                                  std::mt19937 &rand);
 
-void writeNetworkRegTarMI(gene_to_gene_to_float &network,
+void writeNetworkRegTarMI(const CSRNetwork &network,
                           const std::string &file_path);
 
 void writeConsolidatedNetwork(const std::vector<consolidated_df_row> &final_df,
                               const std::string &file_path);
 
+void writeSubnetFile(const CSRNetwork &subnet, const std::string &subnets_dir,
+                     const uint16_t cur_subnet_ct, const std::string &runid);
+void removeSubnetFiles(const std::string &subnets_dir,
+                       const std::string &subnets_log_dir,
+                       const uint16_t cur_subnet_ct, const std::string &runid);
+
 pair_string_vecs
 findSubnetFilesAndSubnetLogFiles(const std::string &subnets_dir,
                                  const std::string &subnets_log_dir);
 
-std::pair<gene_to_gene_to_float, float>
+std::pair<CSRNetwork, float>
 loadARACNe3SubnetsAndUpdateFPRFromLog(const std::string &subnet_file_path,
                                       const std::string &subnet_log_file_path);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ Philox4x32-10 counter-based random number generator (Salmon et al., SC '11).
+ Each output block is a pure function of (key, counter), so independent
+ streams need no shared state: a stream is selected by the high half of the
+ counter, and any number of threads can draw from different streams with
+ results that do not depend on which thread draws which stream, or when.
+
+ Satisfies UniformRandomBitGenerator, so it can drive std::shuffle and the
+ <random> distributions.
+ */
+class Philox4x32 {
+public:
+  typedef uint32_t result_type;
+
+  Philox4x32(const uint64_t key, const uint64_t stream);
+
+  static constexpr result_type min() { return 0U; }
+  static constexpr result_type max() { return UINT32_MAX; }
+
+  result_type operator()() {
+    if (next == 4U)
+      refill();
+    return block[next++];
+  }
+
+private:
+  void refill();
+
+  uint32_t key[2], counter[4], block[4];
+  uint8_t next;
+};
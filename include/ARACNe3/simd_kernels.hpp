@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+ Stable split of a cell's points by y rank, the innermost loop of APMI.  The
+ points are given as parallel arrays of positions and y ranks.  Points with
+ y < thresh are written, in order, to bottom_pts and bottom_ys (which may alias
+ pts and ys, in place), and points with y >= thresh to top_pts and top_ys.
+ Returns the number of bottom points.
+
+ The kernel is chosen once at load time from the CPU's features (AVX-512,
+ AVX2, or scalar), so one binary runs well on any x86-64 node.
+ */
+uint16_t splitByY(const uint16_t *pts, const uint16_t *ys, const uint16_t num,
+                  const uint32_t thresh, uint16_t *bottom_pts,
+                  uint16_t *bottom_ys, uint16_t *top_pts, uint16_t *top_ys);
+
+// Name of the kernel splitByY currently dispatches to
+const std::string &splitKernelName();
+
+// Kernels this CPU can run, best first; "scalar" is always last
+std::vector<std::string> availableSplitKernels();
+
+/*
+ Force splitByY to a kernel from availableSplitKernels().  Not thread-safe; for
+ testing and benchmarking.  Returns false if the kernel is unavailable.
+ */
+bool useSplitKernel(const std::string &name);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "csr_network.hpp"
+#include <vector>
+
+/*
+ Folds subnets into the counts consolidation needs as they are produced, so a
+ subnet can be freed once added.  For each regulator it holds the union of its
+ targets over the subnets added, sorted, with the number of subnets containing
+ each edge, and it keeps the running sum of the subnets' FPR estimates.  Memory
+ is 4 bytes per edge in the union, however many subnets are added.
+ */
+class SubnetAccumulator {
+public:
+  SubnetAccumulator();
+
+  void add(const CSRNetwork &subnet, const float FPR_estimate,
+           const uint16_t nthreads);
+
+  uint16_t numSubnets() const { return num_subnets; }
+  // mean FPR estimate of the subnets added
+  float FPREstimate() const { return FPR_estimate_sum / num_subnets; }
+  uint32_t numRows() const { return targets.size(); }
+  // targets of reg in any subnet, sorted, and the subnets containing each
+  const std::vector<gene_id> &rowTargets(const gene_id reg) const {
+    return reg < numRows() ? targets[reg] : no_targets;
+  }
+  const std::vector<uint16_t> &rowCounts(const gene_id reg) const {
+    return reg < numRows() ? counts[reg] : no_counts;
+  }
+  // smallest regulon over regulators with at least one target (65535 if none);
+  // read from a histogram of regulon sizes kept up to date by add
+  uint16_t minRegulonSize() const;
+
+private:
+  std::vector<std::vector<gene_id>> targets;
+  std::vector<std::vector<uint16_t>> counts;
+  std::vector<uint32_t> num_regulons_of_size;
+  uint16_t num_subnets;
+  float FPR_estimate_sum;
+  static const std::vector<gene_id> no_targets;
+  static const std::vector<uint16_t> no_counts;
+};
@@ -2,24 +2,53 @@
 
 #include "ARACNe3.hpp"
 #include "apmi_nullmodel.hpp"
+#include "csr_network.hpp"
 #include "io.hpp"
+#include "subnet_accumulator.hpp"
 #include <vector>
 
-std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
-    const gene_to_floats &subsample_exp_mat, const geneset &regulators,
+/*
+ Wall time of each step of pruneAlpha, and the number of candidate edges it
+ kept for the cutoff (and, for FDR, sorted), for the subnet log.
+ */
+typedef struct {
+  uint32_t num_candidates;
+  double filter_secs, sort_secs, cutoff_secs, rebuild_secs;
+} prune_alpha_stats;
+
+CSRNetwork pruneAlpha(std::vector<network_edge> reg_tar_mi,
+                      const uint32_t num_rows, uint32_t size_of_network,
+                      const std::string &method, const float alpha,
+                      const APMINullModel &nullmodel, const uint16_t nthreads,
+                      prune_alpha_stats &stats);
+
+/*
+ What pruneMaxEnt enumerated, and the wall time of each of its steps, for the
+ subnet log.
+ */
+typedef struct {
+  uint64_t num_reg_pairs, num_triangles;
+  double enumerate_secs, merge_secs, rebuild_secs;
+} prune_MaxEnt_stats;
+
+CSRNetwork pruneMaxEnt(const CSRNetwork &network, const geneset &regulators,
+                       const uint16_t nthreads, prune_MaxEnt_stats &stats);
+
+std::pair<CSRNetwork, float> createARACNe3Subnet(
+    const gene_to_shorts &subsample_ranks_mat, const geneset &regulators,
     const geneset &genes, const uint16_t tot_num_samps,
     const uint16_t tot_num_subsample, const uint16_t cur_subnet_ct,
     const bool prune_alpha, const APMINullModel &nullmodel,
-    const std::string &method, const float alpha, const bool prune_MaxEnt,
-    const std::string &output_dir, const std::string &subnets_dir,
-    const std::string &subnet_log_dir, const uint16_t nthreads,
-    const std::string &runid);
+    const std::string &method, const float alpha, const float mi_cutoff,
+    const bool prune_MaxEnt, const std::string &output_dir,
+    const std::string &subnets_dir, const std::string &subnet_log_dir,
+    const uint16_t nthreads, const std::string &runid);
 
 const std::vector<consolidated_df_row>
-consolidateSubnetsVec(const std::vector<gene_to_gene_to_float> &subnets,
-                      const float FPR_estimate, const gene_to_floats &exp_mat,
+consolidateSubnetsVec(const SubnetAccumulator &accumulated,
                       const geneset &regulators, const geneset &genes,
-                      const gene_to_shorts &ranks_mat);
+                      const gene_to_shorts &ranks_mat,
+                      const uint16_t nthreads);
 
 class TooManySubnetsRequested : public std::exception {
 public:
@@ -2,18 +2,34 @@
 #include "apmi_nullmodel.hpp"
 #include "cmdline_parser.hpp"
 #include "io.hpp"
+#include "simd_kernels.hpp"
 #include "stopwatch.hpp"
 #include "subnet_operations.hpp"
 
 #include <ctime>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <omp.h>
+#include <optional>
 
 uint16_t nthreads = 1U;
 
 extern std::vector<std::string> decompression_map;
 
+/*
+ Each subnet draws its subsample from its own generator, seeded by the run seed
+ and the subnet's index, so a subnet does not depend on which subnets were
+ generated before it or alongside it.
+ */
+static std::mt19937 subnetRand(const uint32_t seed, const uint16_t subnet_idx) {
+  std::seed_seq subnet_seed{seed, static_cast<uint32_t>(subnet_idx)};
+  return std::mt19937(subnet_seed);
+}
+
 /*
  Main function is the command line executable; this primes the global variables
  and parses the command line.  It will also return usage notes if the user
@@ -58,9 +74,13 @@ int main(int argc, char *argv[]) {
   std::string method = "FDR";
   bool verbose = false;
   uint16_t min_subnets = 0U;
+  uint16_t concurrent_subnets = 1U;
 
   float DEVELOPER_mi_cutoff = 0.0f;
   uint32_t DEVELOPER_num_null_marginals = 1000000U;
+  bool DEVELOPER_adaptive_nulls = false;
+  bool DEVELOPER_null_library = false;
+  std::string DEVELOPER_null_library_range = "";
 
   //--------------------parsing filesystem------------------------
 
@@ -128,6 +148,14 @@ int main(int argc, char *argv[]) {
     verbose = true;
   if (cmdOptionExists(argv, argv + argc, "--min-subnets"))
     min_subnets = std::stoi(getCmdOption(argv, argv + argc, "--min-subnets"));
+  if (cmdOptionExists(argv, argv + argc, "--concurrent-subnets"))
+    concurrent_subnets =
+        std::stoi(getCmdOption(argv, argv + argc, "--concurrent-subnets"));
+  if (concurrent_subnets < 1U || concurrent_subnets > nthreads) {
+    std::cout << "Concurrent subnets not on range [1,threads]; setting to 1."
+              << std::endl;
+    concurrent_subnets = 1U;
+  }
 
   //--------------------developer parameters----------------------
 
@@ -146,6 +174,16 @@ int main(int argc, char *argv[]) {
         << std::endl;
     DEVELOPER_num_null_marginals = 1000000;
   }
+  // --numnulls becomes the most nulls the adaptive null model may compute
+  if (cmdOptionExists(argv, argv + argc, "--adaptive-nulls"))
+    DEVELOPER_adaptive_nulls = true;
+  // interpolate null models for uncached sample sizes from the null library
+  if (cmdOptionExists(argv, argv + argc, "--null-library"))
+    DEVELOPER_null_library = true;
+  // build the null library for sample sizes MIN:MAX:STEP, then exit
+  if (cmdOptionExists(argv, argv + argc, "--build-null-library"))
+    DEVELOPER_null_library_range =
+        getCmdOption(argv, argv + argc, "--build-null-library");
 
   //--------------------------------------------------------------
   //                       Begin ARACNe3
@@ -183,14 +221,47 @@ int main(int argc, char *argv[]) {
              log_file_path + "\"."
       << std::endl;
   log_output << "Beginning ARACNe3 instance..." << std::endl;
+  log_output << "APMI quadrant kernel: " + splitKernelName() << std::endl;
 
   Watch watch1;
   watch1.reset();
 
+  if (!DEVELOPER_null_library_range.empty()) {
+    const size_t colon1 = DEVELOPER_null_library_range.find(':'),
+                 colon2 = DEVELOPER_null_library_range.find(':', colon1 + 1);
+    uint32_t min_n = 0U, max_n = 0U, step_n = 0U;
+    if (colon1 != std::string::npos && colon2 != std::string::npos) {
+      min_n = std::stoi(DEVELOPER_null_library_range.substr(0, colon1));
+      max_n = std::stoi(DEVELOPER_null_library_range.substr(
+          colon1 + 1, colon2 - colon1 - 1));
+      step_n = std::stoi(DEVELOPER_null_library_range.substr(colon2 + 1));
+    }
+    if (min_n < 2U || max_n < min_n || max_n > UINT16_MAX || step_n == 0U) {
+      std::cerr << "Null library range must be MIN:MAX:STEP with 2 <= MIN <= "
+                   "MAX <= 65535 and STEP > 0."
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    log_output << "\nBuilding null library for N = " +
+                      DEVELOPER_null_library_range
+               << std::endl;
+    for (uint32_t n = min_n; n <= max_n; n += step_n) {
+      watch1.reset();
+      APMINullModel library_model(DEVELOPER_num_null_marginals, n, cached_dir,
+                                  rand);
+      library_model.cacheNullModel(cached_dir);
+      log_output << "Null model: " + library_model.getDiagnostics() + " (" +
+                        watch1.getSeconds() + ")"
+                 << std::endl;
+    }
+    return EXIT_SUCCESS;
+  }
+
   log_output << "\nGene expression matrix & regulators list read time: ";
 
   auto data = readExpMatrixAndCopulaTransform(exp_mat_file, rand);
-  const gene_to_floats &exp_mat = std::get<0>(data);
+  const gene_to_shorts &order_mat = std::get<0>(data);
   const gene_to_shorts &ranks_mat = std::get<1>(data);
   const geneset &genes = std::get<2>(data);
   const uint16_t tot_num_samps = std::get<3>(data);
@@ -217,18 +288,21 @@ int main(int argc, char *argv[]) {
   watch1.reset();
   //-------------------------
 
-  APMINullModel nullmodel = APMINullModel(DEVELOPER_num_null_marginals,
-                                          tot_num_subsample, cached_dir, rand);
+  APMINullModel nullmodel =
+      APMINullModel(DEVELOPER_num_null_marginals, tot_num_subsample, cached_dir,
+                    rand, DEVELOPER_adaptive_nulls, alpha,
+                    DEVELOPER_null_library);
   nullmodel.cacheNullModel(cached_dir);
 
   //-------time module-------
   log_output << watch1.getSeconds() << std::endl;
   //-------------------------
 
-  // Must exist regardless of whether we skip to consolidation
-  std::vector<gene_to_gene_to_float> subnets;
-  std::vector<float> FPR_estimates;
-  float FPR_estimate = 1.5E-4f;
+  log_output << "Null model: " + nullmodel.getDiagnostics() << std::endl;
+
+  // Must exist regardless of whether we skip to consolidation.  Each subnet is
+  // folded in and freed as soon as it is produced or read.
+  SubnetAccumulator accumulated;
 
   if (!go_to_consolidate) {
 
@@ -238,65 +312,193 @@ int main(int argc, char *argv[]) {
     watch1.reset();
     //-------------------------
 
-    if (adaptive) {
-      gene_to_geneset regulons(regulators.size());
+    // up to concurrent_subnets subnets are generated at once, each with its
+    // share of the threads
+    omp_set_max_active_levels(2);
+    std::string thread_split;
+
+    /*
+     Subsampling and writing run off the critical path.  When subnets are
+     generated one at a time, the next subnet's subsample is prepared in the
+     background while the current one is computed; in adaptive mode, one
+     prepared for a subnet past the stopping criteria is discarded.  Each
+     subnet file is queued once the subnet is folded in, and one background
+     writer drains the queue in index order, so no thread waits on the disk.
+     At most one subsample and one write are in flight.
+     */
+    const auto sampleSubnet = [&](const uint16_t subnet_idx) {
+      std::mt19937 subnet_rand = subnetRand(seed, subnet_idx);
+      return sampleExpMatAndReCopulaTransform(order_mat, tot_num_subsample,
+                                              subnet_rand);
+    };
+    std::future<gene_to_shorts> prefetched_subsample;
+    uint16_t prefetched_idx = 0U;
+    const auto prefetchSubsample = [&](const uint16_t subnet_idx) {
+      if (concurrent_subnets == 1U) {
+        prefetched_idx = subnet_idx;
+        prefetched_subsample =
+            std::async(std::launch::async, sampleSubnet, prefetched_idx);
+      }
+    };
+    const auto subsampleFor = [&](const uint16_t subnet_idx,
+                                  const bool prefetch_next) {
+      gene_to_shorts subsample_ranks_mat =
+          prefetched_subsample.valid() && prefetched_idx == subnet_idx
+              ? prefetched_subsample.get()
+              : sampleSubnet(subnet_idx);
+      if (prefetch_next)
+        prefetchSubsample(subnet_idx + 1U);
+      return subsample_ranks_mat;
+    };
+
+    // folded subnets not yet written, and whether the writer is running
+    std::mutex unwritten_mutex;
+    std::deque<std::pair<CSRNetwork, uint16_t>> unwritten;
+    bool writing = false;
+    std::future<void> writer;
+    const auto writeUnwritten = [&]() {
+      while (true) {
+        std::pair<CSRNetwork, uint16_t> next;
+        {
+          std::lock_guard<std::mutex> lock(unwritten_mutex);
+          if (unwritten.empty()) {
+            writing = false;
+            return;
+          }
+          next = std::move(unwritten.front());
+          unwritten.pop_front();
+        }
+        writeSubnetFile(next.first, subnets_dir, next.second, runid);
+      }
+    };
+    const auto writeInBackground = [&](CSRNetwork &&subnet,
+                                       const uint16_t subnet_idx) {
+      std::lock_guard<std::mutex> lock(unwritten_mutex);
+      unwritten.emplace_back(std::move(subnet), subnet_idx);
+      if (!writing) {
+        // the last writer has found the queue empty and is returning
+        writing = true;
+        writer = std::async(std::launch::async, writeUnwritten);
+      }
+    };
 
+    if (adaptive) {
       bool stoppingCriteriaMet = false;
-      uint16_t cur_subnet_ct = 0;
-
+      uint16_t cur_subnet_ct = 0, min_regulon_size = 0U;
+
+      /*
+       Subnets are generated speculatively in batches of up to
+       concurrent_subnets, sized by how many more subnets the last batch's
+       growth in occupancy suggests are needed.  The stopping criteria are
+       applied in subnet index order, and the files of subnets past the one
+       that meets them are removed, so the output is the same as generating
+       them one at a time.
+       */
+      uint16_t batch_size = concurrent_subnets;
       while (!stoppingCriteriaMet) {
-        gene_to_floats subsample_exp_mat =
-            sampleExpMatAndReCopulaTransform(exp_mat, tot_num_subsample, rand);
-
-        const auto &[subnet, FPR_estimate_subnet] = createARACNe3Subnet(
-            subsample_exp_mat, regulators, genes, tot_num_samps,
-            tot_num_subsample, cur_subnet_ct, prune_alpha, nullmodel, method,
-            alpha, prune_MaxEnt, output_dir, subnets_dir, subnets_log_dir,
-            nthreads, runid);
-
-        subnets.push_back(subnet);
-        FPR_estimates.push_back(FPR_estimate_subnet);
-
-        if (subnet.size() == 0) {
-          std::cerr << "Abort: No edges left after all pruning steps. Empty "
-                       "subnetwork."
-                    << std::endl;
-          std::exit(EXIT_FAILURE);
+        std::vector<std::pair<CSRNetwork, float>> batch(batch_size);
+        // smaller batches near the stopping criteria get more threads each
+        const uint16_t batch_threads = nthreads / batch_size;
+        thread_split += (thread_split.empty() ? "" : ", ") +
+                        std::to_string(batch_size) + " x " +
+                        std::to_string(batch_threads);
+
+#pragma omp parallel for num_threads(batch_size) schedule(dynamic)
+        for (uint16_t b = 0U; b < batch_size; ++b) {
+          gene_to_shorts subsample_ranks_mat =
+              subsampleFor(cur_subnet_ct + b, b + 1U == batch_size);
+          batch[b] = createARACNe3Subnet(
+              subsample_ranks_mat, regulators, genes, tot_num_samps,
+              tot_num_subsample, cur_subnet_ct + b, prune_alpha, nullmodel,
+              method, alpha, DEVELOPER_mi_cutoff, prune_MaxEnt, output_dir,
+              subnets_dir, subnets_log_dir, batch_threads, runid);
         }
 
-        // add any new edges to the regulon_set
-        for (const auto [reg, tar_mi] : subnet)
-          for (const auto [tar, mi] : tar_mi)
-            regulons[reg].insert(tar);
-
-        // Check minimum regulon size
-        uint16_t min_regulon_size = 65535U;
-        for (const auto &[reg, regulon] : regulons)
-          if (regulons[reg].size() < min_regulon_size)
-            min_regulon_size = regulons[reg].size();
-
-        ++cur_subnet_ct;
+        const uint16_t batch_start = cur_subnet_ct,
+                       prev_min_regulon_size = min_regulon_size;
+        for (uint16_t b = 0U; b < batch_size; ++b) {
+          if (stoppingCriteriaMet) {
+            removeSubnetFiles(subnets_dir, subnets_log_dir, batch_start + b,
+                              runid);
+            continue;
+          }
+
+          auto &[subnet, FPR_estimate_subnet] = batch[b];
+          if (subnet.size() == 0) {
+            std::cerr << "Abort: No edges left after all pruning steps. Empty "
+                         "subnetwork."
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+          }
+
+          // add any new edges to the regulons
+          accumulated.add(subnet, FPR_estimate_subnet, nthreads);
+
+          // Check minimum regulon size
+          min_regulon_size = accumulated.minRegulonSize();
+
+          if (min_regulon_size >= targets_per_regulator &&
+              cur_subnet_ct + 1U >= min_subnets)
+            stoppingCriteriaMet = true;
+
+          writeInBackground(std::move(subnet), cur_subnet_ct);
+          ++cur_subnet_ct;
+        }
 
-        if (min_regulon_size >= targets_per_regulator &&
-            cur_subnet_ct >= min_subnets)
-          stoppingCriteriaMet = true;
+        // subnets still needed at the last batch's rate of occupancy growth
+        const float growth_per_subnet =
+            static_cast<float>(min_regulon_size - prev_min_regulon_size) /
+            batch_size;
+        uint32_t num_needed =
+            min_subnets > cur_subnet_ct ? min_subnets - cur_subnet_ct : 1U;
+        if (growth_per_subnet > 0.0f && min_regulon_size < targets_per_regulator)
+          num_needed = std::max<uint32_t>(
+              num_needed,
+              std::ceil((targets_per_regulator - min_regulon_size) /
+                        growth_per_subnet));
+        else if (min_regulon_size < targets_per_regulator)
+          num_needed = concurrent_subnets;
+        batch_size = std::min<uint32_t>(num_needed, concurrent_subnets);
       }
-      num_subnets = subnets.size();
+      // the subsample prefetched for the subnet after the last is not needed
+      prefetched_subsample = std::future<gene_to_shorts>();
+      num_subnets = accumulated.numSubnets();
     } else if (!adaptive) {
-      subnets = std::vector<gene_to_gene_to_float>(num_subnets);
-      FPR_estimates = std::vector<float>(num_subnets);
+      // finished subnets are folded in by index order, so the result is the
+      // same as generating them one at a time
+      std::vector<std::optional<std::pair<CSRNetwork, float>>> finished(
+          num_subnets);
+      uint16_t num_folded = 0U;
+      const uint16_t subnet_threads = nthreads / concurrent_subnets;
+      thread_split = std::to_string(concurrent_subnets) + " x " +
+                     std::to_string(subnet_threads);
+
+#pragma omp parallel for num_threads(concurrent_subnets) schedule(dynamic)
       for (int i = 0; i < num_subnets; ++i) {
-        gene_to_floats subsample_exp_mat =
-            sampleExpMatAndReCopulaTransform(exp_mat, tot_num_subsample, rand);
-        const auto &[subnet, FPR_estimate_subnet] = createARACNe3Subnet(
-            subsample_exp_mat, regulators, genes, tot_num_samps,
+        gene_to_shorts subsample_ranks_mat =
+            subsampleFor(i, i + 1 < num_subnets);
+        auto subnet_and_FPR = createARACNe3Subnet(
+            subsample_ranks_mat, regulators, genes, tot_num_samps,
             tot_num_subsample, i, prune_alpha, nullmodel, method, alpha,
-            prune_MaxEnt, output_dir, subnets_dir, subnets_log_dir, nthreads,
-            runid);
-        subnets[i] = subnet;
-        FPR_estimates[i] = FPR_estimate_subnet;
+            DEVELOPER_mi_cutoff, prune_MaxEnt, output_dir, subnets_dir,
+            subnets_log_dir, subnet_threads, runid);
+
+#pragma omp critical(fold_subnets)
+        {
+          finished[i] = std::move(subnet_and_FPR);
+          for (; num_folded < num_subnets && finished[num_folded];
+               ++num_folded) {
+            accumulated.add(finished[num_folded]->first,
+                            finished[num_folded]->second, subnet_threads);
+            writeInBackground(std::move(finished[num_folded]->first),
+                              num_folded);
+            finished[num_folded].reset();
+          }
+        }
       }
     }
+    if (writer.valid())
+      writer.get();
 
     //-------time module-------
     log_output << watch1.getSeconds() << std::endl;
@@ -304,6 +506,11 @@ int main(int argc, char *argv[]) {
 
     log_output << "Total subnetworks generated: " + std::to_string(num_subnets)
                << std::endl;
+    if (concurrent_subnets > 1U)
+      log_output << "Subnetworks generated concurrently (subnets x threads "
+                    "each"
+                 << (adaptive ? ", per batch" : "") << "): " << thread_split
+                 << std::endl;
   } else if (go_to_consolidate) {
 
     //-------time module-------
@@ -330,11 +537,10 @@ int main(int argc, char *argv[]) {
           loadARACNe3SubnetsAndUpdateFPRFromLog(
               subnets_dir + subnet_filenames[subnet_idx],
               subnets_log_dir + subnet_log_filenames[subnet_idx]);
-      subnets.push_back(subnet);
-      FPR_estimates.push_back(FPR_estimate_subnet);
+      accumulated.add(subnet, FPR_estimate_subnet, nthreads);
     }
 
-    num_subnets = subnets.size();
+    num_subnets = accumulated.numSubnets();
 
     //-------time module-------
     log_output << watch1.getSeconds() << std::endl;
@@ -344,11 +550,6 @@ int main(int argc, char *argv[]) {
                << std::endl;
   }
 
-  // set the FPR estimate
-  FPR_estimate =
-      std::accumulate(FPR_estimates.begin(), FPR_estimates.end(), 0.0f) /
-      FPR_estimates.size();
-
   if (!do_not_consolidate) {
 
     //-------time module-------
@@ -358,7 +559,7 @@ int main(int argc, char *argv[]) {
     //-------------------------
 
     std::vector<consolidated_df_row> final_df = consolidateSubnetsVec(
-        subnets, FPR_estimate, exp_mat, regulators, genes, ranks_mat);
+        accumulated, regulators, genes, ranks_mat, nthreads);
 
     //-------time module-------
     log_output << watch1.getSeconds() << std::endl;
@@ -1,115 +1,292 @@
 #include "algorithms.hpp"
 #include "ARACNe3.hpp"
+#include "simd_kernels.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <numeric>
 
-extern float DEVELOPER_mi_cutoff;
-
-static float q_thresh;
-static uint16_t size_thresh;
-
 /**
- * @brief Calculate the Mutual Information (MI) for a square struct.
+ * @brief Find the smallest 1-based rank whose copula value reaches a threshold.
  *
- * @param s The square structure for which MI is calculated.
+ * Rank r stands for the copula value r / (n + 1), formed in single precision
+ * as the float kernel would.  Division is monotonic, so every rank at or
+ * above the returned value compares >= thresh, and every rank below compares
+ * < thresh.  This lets the rank kernel make the same quadrant decisions as the
+ * float kernel with one integer comparison per point.
  *
- * @return A float representing the MI of the input square struct.
+ * @param thresh A tessellation threshold on [0, 1] (always dyadic).
+ * @param tot_num_pts The number of samples, n.
+ *
+ * @return The smallest rank r on [1, n + 1] with r / (n + 1) >= thresh.
  */
-float calcMI(const square &s) {
-  const float pxy = s.num_pts / (float)s.tot_num_pts, marginal = s.width,
-              mi = pxy * std::log(pxy / (marginal * marginal));
-  return std::isfinite(mi) ? mi : 0.0f;
+static inline uint32_t copulaRankThreshold(const float thresh,
+                                           const uint16_t tot_num_pts) {
+  const float denom = (float)tot_num_pts + 1;
+  // exact ceil(thresh * (n + 1)); thresh is dyadic, so the product is exact
+  const uint32_t r = std::ceil(static_cast<double>(thresh) * denom);
+  // rounding can only lift the rank just below the exact answer to thresh
+  return (r > 1U && (r - 1U) / denom >= thresh) ? r - 1U : r;
 }
 
 /**
- * @brief Perform recursive tessellation of XY plane and MI calculation at
- * dead-ends.
+ * @brief Branch-free in-place partition of [first, last) so that the indices
+ * satisfying pred come first.
  *
- * This function recursively tessellates the XY plane and calculates the Mutual
- * Information (MI) at dead-ends. The function divides the plane into four
- * quadrants and computes the chi-square statistic for the distribution of
- * points across the quadrants. If the chi-square statistic exceeds a
- * predefined threshold or if the function is operating on the initial square,
- * the function continues to subdivide the plane. Otherwise, it calculates the
- * MI for the current square.
+ * Every element is swapped with the end of the satisfying prefix and the prefix
+ * grows by the predicate, so there are no data-dependent branches for the
+ * (essentially random) quadrant tests to mispredict.
  *
- * Note: The use of alloca is not safe from stack overflow, strictly speaking,
- * but stack overflow is only conceivable in a contrived case, and any generic
- * usage of MINDy3 should never create a stack allocation too large.
+ * @return Pointer to the first index not satisfying pred.
+ */
+template <typename Pred>
+static inline uint16_t *partitionIndices(uint16_t *const first,
+                                         uint16_t *const last, Pred pred) {
+  uint16_t *store = first;
+  for (uint16_t *it = first; it != last; ++it) {
+    const uint16_t p = *it;
+    const bool keep = pred(p);
+    *it = *store;
+    *store = p;
+    store += keep;
+  }
+  return store;
+}
+
+/*
+ A cell of the tessellation that has been split and is waiting on its children.
+ Its points occupy [begin, begin + num_pts) of the shared index buffer, and the
+ four child segments are contiguous sub-ranges of it, in the order tr, br, bl,
+ tl.  child_mi holds the MI of each child once it is done.
+ */
+typedef struct {
+  float x_bound1, y_bound1, width, child_mi[4];
+  uint16_t child_begin[4], child_num_pts[4];
+  uint8_t next_child;
+} apmi_frame;
+
+// Cells this deep are evaluated as leaves.  With unique ranks and
+// size_thresh >= 2 the tessellation cannot get past depth 17.
+static constexpr uint8_t APMI_MAX_DEPTH = 64U;
+
+/*
+ The MI of a leaf cell at depth d holding c of n points is
+ pxy * log(pxy / width^2), with pxy = c / n and width = 2^-d, which is
+ (c log c + c (2 d log 2 - log n)) / n.  Everything but the count is fixed by
+ n and d, so leaf terms are a lookup and a multiply-add into this table.
+ */
+typedef struct {
+  uint16_t tot_num_pts;
+  double inv_tot_num_pts;
+  std::vector<double> count_log_count;
+  double depth_log[APMI_MAX_DEPTH + 1];
+} leaf_mi_table;
+
+/**
+ * @brief The leaf MI table for a sample size.
  *
- * @param x_ptr Pointer to the x-coordinate data.
- * @param y_ptr Pointer to the y-coordinate data.
- * @param s The square struct on which to perform a tessellation.
+ * A subnet or null model evaluates every pair on the same number of samples,
+ * so each thread builds the table once and rebuilds it only when the sample
+ * size changes.
  *
- * @return A float value representing the result of MI calculations, or
- * performs
- * recursion, depending on the condition.
+ * @param tot_num_pts The number of points in the whole plane.
+ * @return The table for tot_num_pts.
  */
-const float calcAPMISplit(const float *const x_ptr, const float *const y_ptr,
-                          const square s) {
-  // if we have less points in the square than size_thresh, calc MI
-  if (s.num_pts < size_thresh) {
-    return calcMI(s);
+static const leaf_mi_table &leafMITable(const uint16_t tot_num_pts) {
+  static thread_local leaf_mi_table table = {0U, 0.0, {0.0}, {0.0}};
+  if (table.count_log_count.size() != tot_num_pts + 1UL) {
+    table.tot_num_pts = tot_num_pts;
+    table.inv_tot_num_pts = 1.0 / tot_num_pts;
+    // an empty cell contributes nothing
+    table.count_log_count.assign(tot_num_pts + 1UL, 0.0);
+    for (uint16_t c = 2U; c <= tot_num_pts; ++c)
+      table.count_log_count[c] = c * std::log((double)c);
+    for (uint8_t d = 0U; d <= APMI_MAX_DEPTH; ++d)
+      table.depth_log[d] = 2 * d * std::log(2.0) - std::log((double)tot_num_pts);
   }
+  return table;
+}
 
-  // thresholds for potential partition of XY plane
-  const float x_thresh = s.x_bound1 + s.width * 0.5f,
-              y_thresh = s.y_bound1 + s.width * 0.5f;
-
-  // indices for quadrants, to test chi-square, with num_pts for each
-  uint16_t *tr_pts, *br_pts, *bl_pts, *tl_pts, tr_num_pts = 0U, br_num_pts = 0U,
-                                               bl_num_pts = 0U, tl_num_pts = 0U;
-  tr_pts = (uint16_t *)alloca(s.num_pts * sizeof(uint16_t));
-  br_pts = (uint16_t *)alloca(s.num_pts * sizeof(uint16_t));
-  bl_pts = (uint16_t *)alloca(s.num_pts * sizeof(uint16_t));
-  tl_pts = (uint16_t *)alloca(s.num_pts * sizeof(uint16_t));
-
-  // points that belong to each quadrant are discovered and sorted
-  // outer for loop will iterate through the pts array
-  for (uint16_t i = 0U; i < s.num_pts; ++i) {
-    // we must pull the actual point index from the pts array
-    const uint16_t p = s.pts[i];
-    const bool top = y_ptr[p] >= y_thresh, right = x_ptr[p] >= x_thresh;
-    if (top && right) {
-      tr_pts[tr_num_pts++] = p;
-    } else if (right) {
-      br_pts[br_num_pts++] = p;
-    } else if (top) {
-      tl_pts[tl_num_pts++] = p;
-    } else {
-      bl_pts[bl_num_pts++] = p;
+/**
+ * @brief Calculate the Mutual Information (MI) contribution of a leaf cell.
+ *
+ * @param table The leaf MI table for the plane's number of points.
+ * @param num_pts The number of points in the cell.
+ * @param depth The depth of the cell, so that its width is 2^-depth.
+ *
+ * @return A float representing the MI of the cell.
+ */
+static inline float calcMI(const leaf_mi_table &table, const uint16_t num_pts,
+                           const uint8_t depth) {
+  return (table.count_log_count[num_pts] + num_pts * table.depth_log[depth]) *
+         table.inv_tot_num_pts;
+}
+
+/**
+ * @brief Perform the tessellation of the XY plane and MI calculation at
+ * dead-ends, without recursion or per-level allocation.
+ *
+ * Each cell is divided into four quadrants and the chi-square statistic for the
+ * distribution of points across the quadrants is computed.  If the chi-square
+ * statistic exceeds q_thresh, or if the cell is the initial square, the cell is
+ * subdivided.  Otherwise, the MI for the cell is calculated.  Cells with fewer
+ * than size_thresh points are always leaves.
+ *
+ * The points of a cell occupy a contiguous segment [begin, begin + num_pts) of
+ * an index buffer owned by the caller, and splitCell rearranges that segment
+ * in place into four contiguous child segments.  Split cells are kept on an
+ * explicit stack of depth-bounded frames.  Children are summed as
+ * (tr + bl) + (br + tl), and the chi-square terms likewise, so the result does
+ * not depend on how splitCell lays out the segments, and swapping x and y (which
+ * swaps br and tl) gives the same value bit-for-bit.
+ *
+ * @param tot_num_pts The number of points.
+ * @param splitCell Called as splitCell(x_bound1, y_bound1, width, begin,
+ * num_pts, child_begin, child_num_pts); partitions the cell's segment and
+ * fills the begin and size of the tr, br, bl, tl child segments.
+ * @param policy Supplies q_thresh and size_thresh (see apmi_default_policy).
+ *
+ * @return A float value representing the APMI of the plane.
+ */
+template <typename SplitFn, typename Policy>
+static float calcAPMITessellate(const uint16_t tot_num_pts, SplitFn splitCell,
+                                const Policy &policy) {
+  const leaf_mi_table &table = leafMITable(tot_num_pts);
+  apmi_frame stack[APMI_MAX_DEPTH];
+  uint8_t depth = 0U;
+
+  /*
+   Partition a cell, and push it on the stack if it should be split.  Returns
+   false if the cell is a leaf, in which case the caller computes its MI.
+   */
+  const auto openCell = [&](const float x_bound1, const float y_bound1,
+                            const float width, const uint16_t begin,
+                            const uint16_t num_pts) -> bool {
+    if (num_pts < policy.size_thresh || depth == APMI_MAX_DEPTH)
+      return false;
+
+    apmi_frame &f = stack[depth];
+    splitCell(x_bound1, y_bound1, width, begin, num_pts, f.child_begin,
+              f.child_num_pts);
+
+    const uint16_t tr_num_pts = f.child_num_pts[0],
+                   br_num_pts = f.child_num_pts[1],
+                   bl_num_pts = f.child_num_pts[2],
+                   tl_num_pts = f.child_num_pts[3];
+
+    // compute chi-square, more efficient not to use pow()
+    const float E = num_pts * 0.25f,
+                chisq = (((tr_num_pts - E) * (tr_num_pts - E) +
+                          (bl_num_pts - E) * (bl_num_pts - E)) +
+                         ((br_num_pts - E) * (br_num_pts - E) +
+                          (tl_num_pts - E) * (tl_num_pts - E))) /
+                        E;
+
+    // partition if chi-square or if initial square
+    if (!(chisq > policy.q_thresh || num_pts == tot_num_pts))
+      return false;
+
+    f.x_bound1 = x_bound1;
+    f.y_bound1 = y_bound1;
+    f.width = width;
+    f.next_child = 0U;
+    ++depth;
+    return true;
+  };
+
+  if (!openCell(0.0f, 0.0f, 1.0f, 0U, tot_num_pts))
+    return calcMI(table, tot_num_pts, 0U);
+
+  while (true) {
+    apmi_frame &f = stack[depth - 1];
+
+    // all children are done; pop and hand the MI to the parent
+    if (f.next_child == 4U) {
+      const float mi = (f.child_mi[0] + f.child_mi[2]) +
+                       (f.child_mi[1] + f.child_mi[3]);
+      if (--depth == 0U)
+        return mi;
+      apmi_frame &parent = stack[depth - 1];
+      parent.child_mi[parent.next_child - 1U] = mi;
+      continue;
     }
-  }
 
-  // compute chi-square, more efficient not to use pow()
-  const float E = s.num_pts * 0.25f,
-              chisq = ((tr_num_pts - E) * (tr_num_pts - E) +
-                       (br_num_pts - E) * (br_num_pts - E) +
-                       (bl_num_pts - E) * (bl_num_pts - E) +
-                       (tl_num_pts - E) * (tl_num_pts - E)) /
-                      E;
-
-  // partition if chi-square or if initial square
-  if (chisq > q_thresh || s.num_pts == s.tot_num_pts) {
-    const square tr{x_thresh, y_thresh,   s.width * 0.5f,
-                    tr_pts,   tr_num_pts, s.tot_num_pts},
-        br{x_thresh, s.y_bound1, s.width * 0.5f,
-           br_pts,   br_num_pts, s.tot_num_pts},
-        bl{s.x_bound1, s.y_bound1, s.width * 0.5f,
-           bl_pts,     bl_num_pts, s.tot_num_pts},
-        tl{s.x_bound1, y_thresh,   s.width * 0.5f,
-           tl_pts,     tl_num_pts, s.tot_num_pts};
-
-    return calcAPMISplit(x_ptr, y_ptr, tr) + calcAPMISplit(x_ptr, y_ptr, br) +
-           calcAPMISplit(x_ptr, y_ptr, bl) + calcAPMISplit(x_ptr, y_ptr, tl);
-  } else {
-    // if we don't partition, then we calc MI
-    return calcMI(s);
+    const uint8_t c = f.next_child++;
+    const float half = f.width * 0.5f;
+    const float x_bound1 = (c < 2U) ? f.x_bound1 + half : f.x_bound1,
+                y_bound1 = (c == 0U || c == 3U) ? f.y_bound1 + half : f.y_bound1;
+    const uint16_t begin = f.child_begin[c], num_pts = f.child_num_pts[c];
+
+    if (!openCell(x_bound1, y_bound1, half, begin, num_pts))
+      f.child_mi[c] = calcMI(table, num_pts, depth);
   }
 }
 
+/**
+ * @brief Call fn with the compile-time apmi_default_policy if the thresholds
+ * are the defaults, and with an apmi_runtime_policy otherwise.
+ */
+template <typename Fn>
+static inline auto withAPMIPolicy(const float q_thresh,
+                                  const uint16_t size_thresh, Fn fn) {
+  if (q_thresh == apmi_default_policy::q_thresh &&
+      size_thresh == apmi_default_policy::size_thresh)
+    return fn(apmi_default_policy());
+  return fn(apmi_runtime_policy{q_thresh, size_thresh});
+}
+
+/**
+ * @brief Tessellate two coordinate vectors with an in-place four-way partition
+ * of the point indices.
+ *
+ * The indices of a cell are partitioned in place into four contiguous segments
+ * (one pass on x, then one pass on y within each half), like a multi-way
+ * quicksort partition.
+ *
+ * @param x_ptr Pointer to the x-coordinate data.
+ * @param y_ptr Pointer to the y-coordinate data.
+ * @param pts Index buffer holding 0, ..., tot_num_pts - 1, in any order.
+ * @param tot_num_pts The number of points.
+ * @param toThresh Converts a float split threshold into the coordinate space of
+ * x_ptr and y_ptr, such that a point is right/top iff coordinate >= result.
+ * @param policy Supplies q_thresh and size_thresh.
+ *
+ * @return A float value representing the APMI of the plane.
+ */
+template <typename T, typename ThreshFn, typename Policy>
+static float calcAPMIPairwise(const T *const x_ptr, const T *const y_ptr,
+                              uint16_t *const pts, const uint16_t tot_num_pts,
+                              ThreshFn toThresh, const Policy &policy) {
+  const auto splitCell = [=](const float x_bound1, const float y_bound1,
+                             const float width, const uint16_t begin,
+                             const uint16_t num_pts, uint16_t *child_begin,
+                             uint16_t *child_num_pts) {
+    // thresholds for potential partition of XY plane
+    const auto x_thresh = toThresh(x_bound1 + width * 0.5f),
+               y_thresh = toThresh(y_bound1 + width * 0.5f);
+
+    uint16_t *const first = pts + begin, *const last = first + num_pts;
+    uint16_t *const right = partitionIndices(
+        first, last, [=](const uint16_t p) { return !(x_ptr[p] >= x_thresh); });
+    uint16_t *const tl = partitionIndices(
+        first, right, [=](const uint16_t p) { return !(y_ptr[p] >= y_thresh); });
+    uint16_t *const tr = partitionIndices(
+        right, last, [=](const uint16_t p) { return !(y_ptr[p] >= y_thresh); });
+
+    child_begin[0] = tr - pts;
+    child_begin[1] = right - pts;
+    child_begin[2] = begin;
+    child_begin[3] = tl - pts;
+    child_num_pts[0] = last - tr;
+    child_num_pts[1] = tr - right;
+    child_num_pts[2] = tl - first;
+    child_num_pts[3] = right - tl;
+  };
+
+  return calcAPMITessellate(tot_num_pts, splitCell, policy);
+}
+
 /**
  * @brief Calculates the Adaptive Partitioning Mutual Information (APMI)
  * between two vectors.
@@ -122,24 +299,431 @@ const float calcAPMISplit(const float *const x_ptr, const float *const y_ptr,
  */
 float calcAPMI(const std::vector<float> &x_vec, const std::vector<float> &y_vec,
                const float q_thresh, const uint16_t size_thresh) {
-  // Set file static variables
-  ::size_thresh = size_thresh;
-  ::q_thresh = q_thresh;
-
-  uint16_t tot_num_pts = x_vec.size();
+  const uint16_t tot_num_pts = x_vec.size();
 
   uint16_t *all_pts = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t));
   std::iota(all_pts, &all_pts[tot_num_pts], 0U);
 
-  // Initialize plane and calc all MIs
-  const square init{0.0f, 0.0f, 1.0f, &all_pts[0U], tot_num_pts, tot_num_pts};
-  float *x_ptr = (float *)alloca(x_vec.size() * sizeof(float)),
-        *y_ptr = (float *)alloca(y_vec.size() * sizeof(float));
+  return withAPMIPolicy(q_thresh, size_thresh, [&](const auto policy) {
+    return calcAPMIPairwise(
+        x_vec.data(), y_vec.data(), all_pts, tot_num_pts,
+        [](const float thresh) { return thresh; }, policy);
+  });
+}
+
+/**
+ * @brief Tessellate points ordered by x rank, classifying only y per split.
+ *
+ * Point p is the sample with x rank p + 1, so the points of a cell, kept in
+ * ascending p, split on x at a single position found by binary search.  Only
+ * the y-side is classified, by splitByY, a stable SIMD split that keeps both
+ * halves sorted by position.  The y ranks travel alongside the positions, so
+ * the split reads both arrays contiguously.  The tessellation is the same as
+ * calcAPMIPairwise's, and so is the result, bit-for-bit.
+ *
+ * @param pts Holds 0, ..., tot_num_pts - 1 on entry.
+ * @param ys Holds the y rank of the sample with x rank p + 1 at ys[p].
+ * @param top_pts Scratch of tot_num_pts for the top half of a split.
+ * @param top_ys Scratch of tot_num_pts for the top half of a split.
+ * @param tot_num_pts The number of points.
+ * @param policy Supplies q_thresh and size_thresh.
+ *
+ * @return A float value representing the APMI of the plane.
+ */
+template <typename Policy>
+static float calcAPMIByPosition(uint16_t *const pts, uint16_t *const ys,
+                                uint16_t *const top_pts,
+                                uint16_t *const top_ys,
+                                const uint16_t tot_num_pts,
+                                const Policy &policy) {
+  const auto splitCell = [=](const float x_bound1, const float y_bound1,
+                             const float width, const uint16_t begin,
+                             const uint16_t num_pts, uint16_t *child_begin,
+                             uint16_t *child_num_pts) {
+    // position of the first point right of the x threshold
+    const uint32_t x_pos =
+        copulaRankThreshold(x_bound1 + width * 0.5f, tot_num_pts) - 1U;
+    const uint32_t y_thresh =
+        copulaRankThreshold(y_bound1 + width * 0.5f, tot_num_pts);
+
+    // bottom points stay in place, top points come back after them
+    uint16_t *const first = pts + begin, *const first_ys = ys + begin;
+    const uint16_t num_bottom =
+        splitByY(first, first_ys, num_pts, y_thresh, first, first_ys, top_pts,
+                 top_ys);
+    std::copy(top_pts, top_pts + num_pts - num_bottom, first + num_bottom);
+    std::copy(top_ys, top_ys + num_pts - num_bottom, first_ys + num_bottom);
+
+    uint16_t *const tl = first + num_bottom, *const last = first + num_pts;
+    uint16_t *const br = std::lower_bound(first, tl, x_pos),
+                    *const tr = std::lower_bound(tl, last, x_pos);
+
+    child_begin[0] = tr - pts;
+    child_begin[1] = br - pts;
+    child_begin[2] = begin;
+    child_begin[3] = tl - pts;
+    child_num_pts[0] = last - tr;
+    child_num_pts[1] = tl - br;
+    child_num_pts[2] = br - first;
+    child_num_pts[3] = tr - tl;
+  };
+
+  return calcAPMITessellate(tot_num_pts, splitCell, policy);
+}
+
+/**
+ * @brief Calculates the APMI between two vectors of 1-based ranks.
+ *
+ * The ranks are those produced by the copula transform (ranks_mat, or the
+ * subsample ranks from sampleExpMatAndReCopulaTransform), so rank r stands for
+ * the copula value r / (n + 1).  Split thresholds are converted into rank
+ * thresholds, so the quadrant tests are integer comparisons, and the result is
+ * bit-for-bit equal to calcAPMI on the float copula values.
+ *
+ * @param x_ranks The first vector of ranks.
+ * @param y_ranks The second vector of ranks.
+ * @param policy Supplies q_thresh and size_thresh.
+ * @return float The APMI value between the two input vectors.
+ */
+template <typename Policy, apmi_policy_t<Policy>>
+float calcAPMI(const std::vector<uint16_t> &x_ranks,
+               const std::vector<uint16_t> &y_ranks, const Policy &policy) {
+  const uint16_t tot_num_pts = x_ranks.size();
+
+  uint16_t *pts = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t)),
+           *ys = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t)),
+           *top_pts = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t)),
+           *top_ys = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t));
+  for (uint16_t i = 0U; i < tot_num_pts; ++i)
+    ys[x_ranks[i] - 1U] = y_ranks[i];
+  std::iota(pts, pts + tot_num_pts, 0U);
+
+  return calcAPMIByPosition(pts, ys, top_pts, top_ys, tot_num_pts, policy);
+}
+
+template float calcAPMI(const std::vector<uint16_t> &,
+                        const std::vector<uint16_t> &,
+                        const apmi_default_policy &);
+template float calcAPMI(const std::vector<uint16_t> &,
+                        const std::vector<uint16_t> &,
+                        const apmi_runtime_policy &);
 
-  std::copy(x_vec.begin(), x_vec.end(), x_ptr);
-  std::copy(y_vec.begin(), y_vec.end(), y_ptr);
+/**
+ * @brief Calculates the APMI between two vectors of 1-based ranks, with
+ * thresholds given at runtime.
+ *
+ * @param x_ranks The first vector of ranks.
+ * @param y_ranks The second vector of ranks.
+ * @param q_thresh A threshold for chi-square.
+ * @param size_thresh A threshold for minimum partition size.
+ * @return float The APMI value between the two input vectors.
+ */
+float calcAPMI(const std::vector<uint16_t> &x_ranks,
+               const std::vector<uint16_t> &y_ranks, const float q_thresh,
+               const uint16_t size_thresh) {
+  return withAPMIPolicy(q_thresh, size_thresh, [&](const auto policy) {
+    return calcAPMI(x_ranks, y_ranks, policy);
+  });
+}
+
+// Depth of the histogram that calcAPMIRegulatorVsMany screens pairs with
+static constexpr uint8_t APMI_SCREEN_DEPTH = 3U;
+static constexpr uint8_t APMI_SCREEN_SIDE = 1U << APMI_SCREEN_DEPTH;
+
+/**
+ * @brief Tessellate a pair from the counts of its depth-APMI_SCREEN_DEPTH
+ * cells, without visiting its points.
+ *
+ * The tessellation only looks at how many points fall in each dyadic cell, so
+ * as long as no cell deeper than APMI_SCREEN_DEPTH - 1 is split, the counts
+ * decide every split and leaf exactly as the point kernels would.  The same
+ * engine sums the leaves, so a resolved pair has the same APMI bit-for-bit.
+ *
+ * @param counts Point counts of the APMI_SCREEN_SIDE^2 cells, indexed by
+ * x cell * APMI_SCREEN_SIDE + y cell.
+ * @param tot_num_pts The number of points.
+ * @param policy Supplies q_thresh and size_thresh.
+ * @param mi Set to the APMI if the pair is resolved.
+ *
+ * @return false if the tessellation must split a cell deeper than the
+ * histogram, in which case mi is not set.
+ */
+template <typename Policy>
+static bool calcAPMIFromHistogram(const uint16_t *const counts,
+                                  const uint16_t tot_num_pts,
+                                  const Policy &policy, float &mi) {
+  // counts at every depth, coarser levels summed from the finest
+  uint16_t levels[APMI_SCREEN_DEPTH + 1U][APMI_SCREEN_SIDE * APMI_SCREEN_SIDE];
+  std::copy(counts, counts + APMI_SCREEN_SIDE * APMI_SCREEN_SIDE,
+            levels[APMI_SCREEN_DEPTH]);
+  for (uint8_t d = APMI_SCREEN_DEPTH; d > 0U; --d) {
+    const uint8_t side = 1U << (d - 1U), fine = 2U * side;
+    for (uint8_t x = 0U; x < side; ++x)
+      for (uint8_t y = 0U; y < side; ++y)
+        levels[d - 1U][x * side + y] =
+            levels[d][2U * x * fine + 2U * y] +
+            levels[d][2U * x * fine + 2U * y + 1U] +
+            levels[d][(2U * x + 1U) * fine + 2U * y] +
+            levels[d][(2U * x + 1U) * fine + 2U * y + 1U];
+  }
+
+  bool resolved = true;
+  const auto splitCell = [&](const float x_bound1, const float y_bound1,
+                             const float width, const uint16_t begin,
+                             const uint16_t num_pts, uint16_t *child_begin,
+                             uint16_t *child_num_pts) {
+    std::fill(child_begin, child_begin + 4, begin);
+    const int depth = 1 - std::ilogb(width);
+    if (depth > APMI_SCREEN_DEPTH) {
+      // the result is discarded; even children make this cell a leaf
+      resolved = false;
+      std::fill(child_num_pts, child_num_pts + 4, num_pts / 4U);
+      child_num_pts[0] += num_pts % 4U;
+      return;
+    }
+    const uint8_t side = 1U << depth;
+    const uint8_t x = x_bound1 * side, y = y_bound1 * side;
+    const uint16_t *const level = levels[depth];
+    child_num_pts[0] = level[(x + 1U) * side + y + 1U];
+    child_num_pts[1] = level[(x + 1U) * side + y];
+    child_num_pts[2] = level[x * side + y];
+    child_num_pts[3] = level[x * side + y + 1U];
+  };
+
+  const float result = calcAPMITessellate(tot_num_pts, splitCell, policy);
+  if (resolved)
+    mi = result;
+  return resolved;
+}
+
+apmi_regulator_order::apmi_regulator_order(
+    const std::vector<uint16_t> &reg_ranks)
+    : by_reg_rank(reg_ranks.size()), rank_cell(reg_ranks.size() + 1U) {
+  const uint16_t tot_num_pts = reg_ranks.size();
+  const float denom = (float)tot_num_pts + 1;
+  for (uint16_t i = 0U; i < tot_num_pts; ++i)
+    by_reg_rank[reg_ranks[i] - 1U] = i;
+
+  // screening histogram cell of each rank (exact power-of-two scaling)
+  for (uint16_t r = 1U; r <= tot_num_pts; ++r)
+    rank_cell[r] = r / denom * APMI_SCREEN_SIDE;
+}
+
+/**
+ * @brief Calculates the APMI of one regulator against many targets, reusing
+ * the regulator's x-partition.
+ *
+ * The x-side of every split depends only on the regulator, so its samples are
+ * put in rank order once (reg_order), and per target only the y-side is
+ * classified (see calcAPMIByPosition).  The results are bit-for-bit equal to
+ * calcAPMI(reg_ranks, target ranks).
+ *
+ * @param reg_order The regulator's samples in rank order.
+ * @param ranks_mat The 1-based ranks of every gene on the same samples.
+ * @param targets The genes in ranks_mat to compute APMI against.
+ * @param policy Supplies q_thresh and size_thresh.
+ * @param num_screened If given, set to the number of targets resolved by the
+ * screening histogram.
+ *
+ * @return The APMI against each of targets, in the same order.
+ */
+template <typename Policy, apmi_policy_t<Policy>>
+std::vector<float> calcAPMIRegulatorVsMany(const apmi_regulator_order &reg_order,
+                                           const gene_to_shorts &ranks_mat,
+                                           const std::vector<gene_id> &targets,
+                                           const Policy &policy,
+                                           uint32_t *num_screened) {
+  const uint16_t tot_num_pts = reg_order.by_reg_rank.size();
+  const uint16_t *const by_reg_rank = reg_order.by_reg_rank.data();
+  const uint8_t *const rank_cell = reg_order.rank_cell.data();
+
+  uint16_t *pts = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t)),
+           *ys = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t)),
+           *top_pts = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t)),
+           *top_ys = (uint16_t *)alloca(tot_num_pts * sizeof(uint16_t));
+
+  std::vector<float> mis(targets.size());
+  uint32_t screened = 0U;
+  for (size_t t = 0U; t < targets.size(); ++t) {
+    const std::vector<uint16_t> &tar_ranks = ranks_mat[targets[t]];
+    uint16_t counts[APMI_SCREEN_SIDE * APMI_SCREEN_SIDE] = {0U};
+    for (uint16_t k = 0U; k < tot_num_pts; ++k) {
+      ys[k] = tar_ranks[by_reg_rank[k]];
+      ++counts[rank_cell[k + 1U] * APMI_SCREEN_SIDE + rank_cell[ys[k]]];
+    }
+
+    // most pairs never split below the histogram and skip the full kernel
+    if (calcAPMIFromHistogram(counts, tot_num_pts, policy, mis[t])) {
+      ++screened;
+      continue;
+    }
+
+    std::iota(pts, pts + tot_num_pts, 0U);
+    mis[t] =
+        calcAPMIByPosition(pts, ys, top_pts, top_ys, tot_num_pts, policy);
+  }
+
+  if (num_screened)
+    *num_screened = screened;
+  return mis;
+}
+
+template std::vector<float>
+calcAPMIRegulatorVsMany(const apmi_regulator_order &, const gene_to_shorts &,
+                        const std::vector<gene_id> &,
+                        const apmi_default_policy &, uint32_t *);
+template std::vector<float>
+calcAPMIRegulatorVsMany(const apmi_regulator_order &, const gene_to_shorts &,
+                        const std::vector<gene_id> &,
+                        const apmi_runtime_policy &, uint32_t *);
+
+/**
+ * @brief calcAPMIRegulatorVsMany building the regulator's order for one call.
+ */
+template <typename Policy, apmi_policy_t<Policy>>
+std::vector<float> calcAPMIRegulatorVsMany(const std::vector<uint16_t> &reg_ranks,
+                                           const gene_to_shorts &ranks_mat,
+                                           const std::vector<gene_id> &targets,
+                                           const Policy &policy,
+                                           uint32_t *num_screened) {
+  return calcAPMIRegulatorVsMany(apmi_regulator_order(reg_ranks), ranks_mat,
+                                 targets, policy, num_screened);
+}
+
+template std::vector<float>
+calcAPMIRegulatorVsMany(const std::vector<uint16_t> &, const gene_to_shorts &,
+                        const std::vector<gene_id> &,
+                        const apmi_default_policy &, uint32_t *);
+template std::vector<float>
+calcAPMIRegulatorVsMany(const std::vector<uint16_t> &, const gene_to_shorts &,
+                        const std::vector<gene_id> &,
+                        const apmi_runtime_policy &, uint32_t *);
+
+/**
+ * @brief calcAPMIRegulatorVsMany with thresholds given at runtime.
+ */
+std::vector<float> calcAPMIRegulatorVsMany(const std::vector<uint16_t> &reg_ranks,
+                                           const gene_to_shorts &ranks_mat,
+                                           const std::vector<gene_id> &targets,
+                                           const float q_thresh,
+                                           const uint16_t size_thresh,
+                                           uint32_t *num_screened) {
+  return withAPMIPolicy(q_thresh, size_thresh, [&](const auto policy) {
+    return calcAPMIRegulatorVsMany(reg_ranks, ranks_mat, targets, policy,
+                                   num_screened);
+  });
+}
+
+/**
+ * @brief Interleave the bits of x and y into a 64-bit Morton code, x taking
+ * the more significant bit of each pair.
+ */
+static inline uint64_t mortonCode(const uint32_t x, const uint32_t y) {
+  const auto spread = [](uint64_t v) {
+    v = (v | (v << 16U)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8U)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4U)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2U)) & 0x3333333333333333ULL;
+    v = (v | (v << 1U)) & 0x5555555555555555ULL;
+    return v;
+  };
+  return (spread(x) << 1U) | spread(y);
+}
+
+/**
+ * @brief Calculates the APMI between two vectors of 1-based ranks as a
+ * counting problem over a quadtree of Morton codes.
+ *
+ * Every split halves the width, so a point's cell at depth d is given by the
+ * top d bits of floor(copula * 2^32) on each axis (the float scaling is exact,
+ * so these bits agree with the float kernel's threshold comparisons).
+ * Interleaving the bits into Morton codes and sorting them makes every
+ * quadtree cell a contiguous range of codes, with its children in the order
+ * bl, tl, br, tr.  Sorting is one LSD radix pass per byte, over only the
+ * 2 * (ceil(log2(n + 1)) + 1) leading bits; below that depth a cell holds at
+ * most one point.  The chi-square stop rule then runs over counts found by
+ * binary search, without moving any points.
+ *
+ * Returns the same value as calcAPMI, bit-for-bit, unless single-point cells
+ * can split (size_thresh < 2 and q_thresh < 3), a degenerate setting in which
+ * both engines only stop at their depth limits.
+ *
+ * @param x_ranks The first vector of ranks.
+ * @param y_ranks The second vector of ranks.
+ * @param q_thresh A threshold for chi-square.
+ * @param size_thresh A threshold for minimum partition size.
+ * @return float The APMI value between the two input vectors.
+ */
+float calcAPMIMorton(const std::vector<uint16_t> &x_ranks,
+                     const std::vector<uint16_t> &y_ranks, const float q_thresh,
+                     const uint16_t size_thresh) {
+  const uint16_t tot_num_pts = x_ranks.size();
+  const float denom = (float)tot_num_pts + 1;
+
+  // depth at which a cell holds at most one point
+  uint8_t max_depth = 1U;
+  while ((1UL << (max_depth - 1U)) < tot_num_pts + 1UL)
+    ++max_depth;
+  const uint8_t num_bytes = (2U * std::min<uint8_t>(max_depth, 32U) + 7U) / 8U;
+
+  std::vector<uint64_t> codes(tot_num_pts), sorted(tot_num_pts);
+  for (uint16_t i = 0U; i < tot_num_pts; ++i)
+    codes[i] = mortonCode(x_ranks[i] / denom * 4294967296.0f,
+                          y_ranks[i] / denom * 4294967296.0f);
+
+  // LSD radix sort on the leading num_bytes bytes
+  for (uint8_t b = 8U - num_bytes; b < 8U; ++b) {
+    const uint8_t shift = 8U * b;
+    uint32_t offsets[257] = {0U};
+    for (const uint64_t code : codes)
+      ++offsets[((code >> shift) & 0xFFU) + 1U];
+    for (uint16_t d = 1U; d < 257U; ++d)
+      offsets[d] += offsets[d - 1U];
+    for (const uint64_t code : codes)
+      sorted[offsets[(code >> shift) & 0xFFU]++] = code;
+    codes.swap(sorted);
+  }
+
+  const uint64_t *const first_code = codes.data();
+  // a cell's codes locate it, so only its width is needed, not its bounds
+  const auto splitCell = [=](const float /* x_bound1 */,
+                             const float /* y_bound1 */, const float width,
+                             const uint16_t begin,
+                             const uint16_t num_pts, uint16_t *child_begin,
+                             uint16_t *child_num_pts) {
+    const int depth = -std::ilogb(width);
+    const uint64_t *const first = first_code + begin,
+                          *const last = first + num_pts;
+
+    // codes in a cell share their leading bits, so the children's two-bit
+    // digit is non-decreasing along the range
+    const uint64_t *tl = last, *br = last, *tr = last;
+    if (depth < std::min<int>(max_depth, 32)) {
+      const int shift = 62 - 2 * depth;
+      const auto digit = [shift](const uint64_t code) {
+        return (code >> shift) & 3U;
+      };
+      tl = std::partition_point(first, last,
+                                [&](const uint64_t c) { return digit(c) < 1U; });
+      br = std::partition_point(tl, last,
+                                [&](const uint64_t c) { return digit(c) < 2U; });
+      tr = std::partition_point(br, last,
+                                [&](const uint64_t c) { return digit(c) < 3U; });
+    }
 
-  return calcAPMISplit(x_ptr, y_ptr, init);
+    child_begin[0] = tr - first_code;
+    child_begin[1] = br - first_code;
+    child_begin[2] = begin;
+    child_begin[3] = tl - first_code;
+    child_num_pts[0] = last - tr;
+    child_num_pts[1] = tr - br;
+    child_num_pts[2] = tl - first;
+    child_num_pts[3] = br - tl;
+  };
+
+  return withAPMIPolicy(q_thresh, size_thresh, [&](const auto policy) {
+    return calcAPMITessellate(tot_num_pts, splitCell, policy);
+  });
 }
 
 /** @brief Ranks indices based on the values in vec.
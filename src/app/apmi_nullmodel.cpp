@@ -1,35 +1,289 @@
 #include "apmi_nullmodel.hpp"
 #include "ARACNe3.hpp"
 #include "algorithms.hpp"
+#include "philox.hpp"
 #include <filesystem>
 #include <fstream>
+#include <iostream>
 #include <iterator>
+#include <limits>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <tuple>
 #include <omp.h>
 
+#if defined __linux__ || defined __APPLE__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 extern uint16_t nthreads;
 
+static const char null_cache_magic[8] = {'A', '3', 'N', 'U', 'L', 'L', 'S', '\0'};
+static constexpr uint32_t null_cache_version = 1U;
+
+// Nulls per batch of an adaptive null model
+static constexpr uint32_t NULL_BATCH_SIZE = 20000U;
+// Relative change in the tail fit and the null MI at p = alpha, between
+// batches, below which an adaptive null model stops
+static constexpr float NULL_FIT_TOLERANCE = 0.01f;
+
+// Buckets of the MI -> p lookup table span 2^PVAL_TABLE_SHIFT float values
+static constexpr uint32_t PVAL_TABLE_SHIFT = 10U;
+static constexpr uint32_t PVAL_TABLE_MAX_BUCKETS = 1U << 17U;
+
+// Maps floats to uint32_t such that a < b if and only if key(a) < key(b)
+static inline uint32_t orderedKey(const float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits & 0x80000000U ? ~bits : bits | 0x80000000U;
+}
+
+static inline float floatOfKey(const uint32_t key) {
+  const uint32_t bits = key & 0x80000000U ? key & 0x7FFFFFFFU : ~key;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// 64-bit FNV-1a hash of the bytes of the nulls
+static uint64_t checksumNulls(const float *const nulls,
+                              const uint32_t num_nulls) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(nulls);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0U; i < num_nulls * sizeof(float); ++i)
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+/*
+ OLS regression of log(p) on MI over the nulls with eCDF p < 0.01, the
+ exponential tail getMIPVal uses beyond p_precise.  null_mis must be sorted
+ largest to smallest.
+ */
+static std::pair<float, float> fitNullTail(const std::vector<float> &null_mis) {
+  const uint32_t n_nulls = null_mis.size();
+  uint32_t significant_thresh_idx =
+      std::ceil(n_nulls * 1.0f / 100.0f); // index of p = 0.01
+  std::vector<float> significant_mis(
+      null_mis.begin(), null_mis.begin() + significant_thresh_idx);
+  std::vector<float> significant_mi_ps(significant_thresh_idx);
+  for (uint32_t i = 0; i < significant_thresh_idx; ++i)
+    significant_mi_ps[i] = ((i + 1) / (float)n_nulls); // fill p-vals
+  std::transform(significant_mi_ps.begin(),
+                 significant_mi_ps.begin() + significant_thresh_idx,
+                 significant_mi_ps.begin(), [](const auto &p) -> float {
+                   return std::log(p);
+                 }); // log-transform
+
+  return linearRegress(significant_mis, significant_mi_ps);
+}
+
 APMINullModel::APMINullModel(const APMINullModel &copied) {
   null_mis = copied.null_mis;
+  mapping = copied.mapping;
+  nulls = mapping ? copied.nulls : null_mis.data();
+  num_nulls = copied.num_nulls;
+  tot_num_subsample = copied.tot_num_subsample;
+  adaptive = copied.adaptive;
+  converged = copied.converged;
+  alpha = copied.alpha;
+  num_batches = copied.num_batches;
+  library_lo = copied.library_lo;
+  library_hi = copied.library_hi;
+  interpolation_error = copied.interpolation_error;
+  pval_table = copied.pval_table;
+  pval_table_key_lo = copied.pval_table_key_lo;
   m = copied.m;
   b = copied.b;
   nulls_filename_no_extension = copied.nulls_filename_no_extension;
   OLS_coefs_filename_no_extension = copied.OLS_coefs_filename_no_extension;
 }
 
+/*
+ Maps the binary cache read-only, so concurrent runs on a node share one
+ page-cache copy of the nulls (on other platforms the nulls are read into
+ memory).  Returns false, leaving the model untouched, if the file is missing
+ or its header, parameters, size or checksum do not match this model; a
+ mismatch is reported with if_invalid saying what happens to the file.
+ */
+bool APMINullModel::mapBinaryCache(const std::string &filename,
+                                   const std::string &if_invalid) {
+  if (!std::filesystem::exists(filename))
+    return false;
+
+  null_cache_header header;
+  std::shared_ptr<const void> file_mapping;
+  const float *file_nulls = nullptr;
+  std::vector<float> file_null_mis;
+
+#if defined __linux__ || defined __APPLE__
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(null_cache_header)) {
+    close(fd);
+    return false;
+  }
+  const size_t length = st.st_size;
+  void *const addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+  file_mapping = std::shared_ptr<const void>(
+      addr, [length](const void *p) { munmap(const_cast<void *>(p), length); });
+  std::memcpy(&header, addr, sizeof(null_cache_header));
+  if (length != sizeof(null_cache_header) + header.n_nulls * sizeof(float))
+    return false;
+  file_nulls = reinterpret_cast<const float *>(
+      static_cast<const char *>(addr) + sizeof(null_cache_header));
+#else
+  std::ifstream cache_file(filename, std::ios::in | std::ios::binary);
+  if (!cache_file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    return false;
+  file_null_mis.resize(header.n_nulls);
+  if (!cache_file.read(reinterpret_cast<char *>(file_null_mis.data()),
+                       header.n_nulls * sizeof(float)))
+    return false;
+  file_nulls = file_null_mis.data();
+#endif
+
+  if (std::memcmp(header.magic, null_cache_magic, sizeof(null_cache_magic)) ||
+      header.version != null_cache_version ||
+      header.tot_num_subsample != tot_num_subsample ||
+      (adaptive ? header.n_nulls > num_nulls : header.n_nulls != num_nulls) ||
+      header.alpha != alpha ||
+      header.q_thresh != apmi_default_policy::q_thresh ||
+      header.size_thresh != apmi_default_policy::size_thresh ||
+      header.checksum != checksumNulls(file_nulls, header.n_nulls)) {
+    std::cerr << "Warning: null model cache \"" + filename +
+                     "\" is invalid or outdated and " + if_invalid + "."
+              << std::endl;
+    return false;
+  }
+
+  this->mapping = file_mapping;
+  this->null_mis = std::move(file_null_mis);
+  this->nulls = mapping ? file_nulls : null_mis.data();
+  this->num_nulls = header.n_nulls;
+  this->m = header.m;
+  this->b = header.b;
+  return true;
+}
+
+/*
+ The null library is the set of binary caches in cached_dir with this model's
+ number of nulls, one per sample size, e.g. as built by --build-null-library.
+ Loads the library's nearest sizes below and above tot_num_subsample and
+ interpolates each null quantile, and the tail fit, linearly in 1 / N (the
+ order of the APMI bias under the null).  Returns false, leaving the model
+ untouched, if tot_num_subsample is not strictly inside the library's range.
+
+ Null quantiles fall as N grows, so the true quantile lies between its two
+ neighbours and the interpolated one is off by at most max(w, 1 - w) times
+ their gap.  interpolation_error is that bound, maximized over the nulls
+ getMIPVal reads p-values from (p >= 0.001; the sparse extreme tail is left to
+ the fit).
+ */
+bool APMINullModel::interpolateFromLibrary(const std::string &cached_dir) {
+  const std::string suffix = "_Nnull-" + std::to_string(num_nulls) + ".bin";
+  uint16_t lo = 0U, hi = UINT16_MAX;
+  for (const auto &entry : std::filesystem::directory_iterator(cached_dir)) {
+    const std::string name = entry.path().filename().string();
+    if (name.rfind("Nssamp-", 0U) != 0U || name.size() <= suffix.size() ||
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+      continue;
+    const std::string size = name.substr(
+        std::strlen("Nssamp-"),
+        name.size() - suffix.size() - std::strlen("Nssamp-"));
+    if (size.empty() ||
+        size.find_first_not_of("0123456789") != std::string::npos ||
+        size.size() > 5U)
+      continue;
+    const uint32_t n = std::stoul(size);
+    if (n < tot_num_subsample && n > lo)
+      lo = n;
+    else if (n > tot_num_subsample && n < hi)
+      hi = n;
+  }
+  if (lo == 0U || hi == UINT16_MAX)
+    return false;
+
+  // each neighbour is validated exactly as this model's own cache would be
+  const std::string if_invalid = "is not interpolated from";
+  APMINullModel lower(*this), upper(*this);
+  lower.tot_num_subsample = lo;
+  upper.tot_num_subsample = hi;
+  if (!lower.mapBinaryCache(
+          cached_dir + "Nssamp-" + std::to_string(lo) + suffix, if_invalid) ||
+      !upper.mapBinaryCache(
+          cached_dir + "Nssamp-" + std::to_string(hi) + suffix, if_invalid))
+    return false;
+
+  const float w = (1.0f / tot_num_subsample - 1.0f / lo) /
+                  (1.0f / hi - 1.0f / lo);
+  const uint32_t precise_idx = std::ceil(num_nulls * 1.0f / 1000.0f);
+  float max_gap = 0.0f;
+  null_mis.resize(num_nulls);
+  for (uint32_t i = 0U; i < num_nulls; ++i) {
+    null_mis[i] = (1.0f - w) * lower.nulls[i] + w * upper.nulls[i];
+    if (i >= precise_idx)
+      max_gap = std::max(max_gap, std::abs(lower.nulls[i] - upper.nulls[i]));
+  }
+
+  this->nulls = null_mis.data();
+  this->m = (1.0f - w) * lower.m + w * upper.m;
+  this->b = (1.0f - w) * lower.b + w * upper.b;
+  this->library_lo = lo;
+  this->library_hi = hi;
+  this->interpolation_error = std::max(w, 1.0f - w) * max_gap;
+  return true;
+}
+
 /*
  Computes 1 million null mutual information values for the sample size.  Checks
  whether there already exists a null_mi vector (nulls_filename) in the cached
  directory.
+
+ Null i is the APMI between the identity and a permutation drawn from its own
+ Philox stream, keyed by one draw from rand.  Nulls are therefore independent
+ of one another and of which thread computes them, so the model is the same
+ for any number of threads, and rand advances by one draw whether or not the
+ model is cached.
+
+ If adaptive, n_nulls is only the most that are computed (see below).  If
+ from_library and there is no cache for this sample size, the model is
+ interpolated from the null library instead of computed (see
+ interpolateFromLibrary).
  */
 APMINullModel::APMINullModel(const uint32_t n_nulls,
                              const uint16_t tot_num_subsample,
-                             const std::string &cached_dir,
-                             std::mt19937 &rand) {
-  this->nulls_filename_no_extension = "Nssamp-" +
-                                      std::to_string(tot_num_subsample) +
-                                      "_Nnull-" + std::to_string(n_nulls);
+                             const std::string &cached_dir, std::mt19937 &rand,
+                             const bool adaptive, const float alpha,
+                             const bool from_library) {
+  this->nulls_filename_no_extension =
+      "Nssamp-" + std::to_string(tot_num_subsample) + "_Nnull-" +
+      std::to_string(n_nulls) +
+      (adaptive ? "_adaptive-" + std::to_string(alpha) : "");
   this->OLS_coefs_filename_no_extension = nulls_filename_no_extension + "_OLS";
+  // set before anything can copy the model (see interpolateFromLibrary)
+  this->nulls = nullptr;
+  this->num_nulls = n_nulls;
+  this->tot_num_subsample = tot_num_subsample;
+  this->m = this->b = 0.0f;
+  this->pval_table_key_lo = 0U;
+  this->adaptive = adaptive;
+  this->converged = true;
+  this->alpha = adaptive ? alpha : 0.0f;
+  this->num_batches = 0U;
+  this->library_lo = this->library_hi = 0U;
+  this->interpolation_error = 0.0f;
+  const uint64_t null_key = rand();
 
 #ifdef _DEBUG // If debug, we must generate a new null model each time
   constexpr bool debug = true;
@@ -37,8 +291,12 @@ APMINullModel::APMINullModel(const uint32_t n_nulls,
   constexpr bool debug = false;
 #endif
 
-  if (std::filesystem::exists(cached_dir + nulls_filename_no_extension +
-                              ".txt") &&
+  if (!debug &&
+      mapBinaryCache(cached_dir + nulls_filename_no_extension + ".bin")) {
+    // nulls are mapped from the binary cache
+  } else if (!adaptive &&
+             std::filesystem::exists(cached_dir + nulls_filename_no_extension +
+                                     ".txt") &&
       std::filesystem::exists(cached_dir + OLS_coefs_filename_no_extension +
                               ".txt") &&
       !debug) {
@@ -52,84 +310,300 @@ APMINullModel::APMINullModel(const uint32_t n_nulls,
     std::istream_iterator<float> nulls_iterator(nulls_file);
     std::istream_iterator<float> OLS_iterator(OLS_coef_file);
 
+    // legacy text cache; cacheNullModel migrates it to the binary format
     for (uint32_t i = 0; i < n_nulls; ++i)
       null_mis.emplace_back(*nulls_iterator++);
+    this->nulls = null_mis.data();
     this->m = *OLS_iterator++;
     this->b = *OLS_iterator;
+  } else if (!debug && !adaptive && from_library &&
+             interpolateFromLibrary(cached_dir)) {
+    // nulls are interpolated between neighbouring sizes in the library
   } else {
-    // make the ref vector for null APMI against shuffled version
-    std::vector<float> ref_vec;
-    ref_vec.reserve(tot_num_subsample);
+    // make the ref vector of ranks for null APMI against shuffled version
+    std::vector<uint16_t> ref_vec(tot_num_subsample);
+    std::iota(ref_vec.begin(), ref_vec.end(), 1U);
+
+    /*
+     Nulls are computed in batches and merged into null_mis, kept sorted
+     largest to smallest.  Null i always comes from Philox stream i, so an
+     adaptive model holds exactly the first num_nulls nulls of the full model.
+     After each batch the adaptive model refits the tail and stops once the
+     fit and the null MI at p = alpha have settled.
+     */
+    const uint32_t batch_size =
+        adaptive ? std::min(n_nulls, NULL_BATCH_SIZE) : n_nulls;
+    float prev_m = 0.0f, prev_b = 0.0f, prev_mi_alpha = 0.0f;
+    uint32_t num_done = 0U;
+    this->converged = !adaptive;
+
+    while (num_done < n_nulls) {
+      const uint32_t batch_end = std::min(num_done + batch_size, n_nulls);
+      null_mis.resize(batch_end);
 
-    for (uint16_t i = 1U; i <= tot_num_subsample; ++i)
-      ref_vec.emplace_back(((float)i) / (tot_num_subsample + 1));
+#pragma omp parallel num_threads(nthreads)
+      {
+        std::vector<uint16_t> null_vec(tot_num_subsample);
 
-    std::vector<float> shuffle_vec = ref_vec;
+#pragma omp for schedule(static, 1024)
+        for (uint32_t i = num_done; i < batch_end; ++i) {
+          Philox4x32 stream(null_key, i);
+          std::iota(null_vec.begin(), null_vec.end(), 1U);
+          std::shuffle(null_vec.begin(), null_vec.end(), stream);
+          null_mis[i] = calcAPMI(ref_vec, null_vec);
+        }
+      }
 
-    this->null_mis = std::vector<float>(n_nulls);
+      // sort largest to smallest
+      std::sort(null_mis.begin() + num_done, null_mis.end(),
+                std::greater<float>());
+      std::inplace_merge(null_mis.begin(), null_mis.begin() + num_done,
+                         null_mis.end(), std::greater<float>());
+      num_done = batch_end;
+      ++num_batches;
 
-#pragma omp parallel for num_threads(nthreads)
-    for (uint32_t i = 0U; i < n_nulls; ++i) {
-#pragma omp critical
-      { std::shuffle(shuffle_vec.begin(), shuffle_vec.end(), rand); }
-      null_mis[i] = calcAPMI(ref_vec, shuffle_vec);
+      std::tie(this->m, this->b) = fitNullTail(null_mis);
+      if (adaptive) {
+        const float mi_alpha =
+            null_mis[std::max<uint32_t>(std::ceil(alpha * num_done), 1U) - 1U];
+        const auto settled = [](const float cur, const float prev) {
+          return std::abs(cur - prev) <= NULL_FIT_TOLERANCE * std::abs(prev);
+        };
+        if (num_batches > 1U && settled(m, prev_m) && settled(b, prev_b) &&
+            settled(mi_alpha, prev_mi_alpha)) {
+          this->converged = true;
+          break;
+        }
+        prev_m = m;
+        prev_b = b;
+        prev_mi_alpha = mi_alpha;
+      }
     }
 
-    // sort largest to smallest
-    std::sort(null_mis.begin(), null_mis.end(), std::greater<float>());
-
-    // OLS regress log(p) vs MI for eCDF p < 0.01
-    uint32_t significant_thresh_idx =
-        std::ceil(n_nulls * 1.0f / 100.0f); // index of p = 0.01
-    std::vector<float> significant_mis(
-        null_mis.begin(), null_mis.begin() + significant_thresh_idx);
-    std::vector<float> significant_mi_ps(significant_thresh_idx);
-    for (uint32_t i = 0; i < significant_thresh_idx; ++i)
-      significant_mi_ps[i] = ((i + 1) / (float)n_nulls); // fill p-vals
-    std::transform(significant_mi_ps.begin(),
-                   significant_mi_ps.begin() + significant_thresh_idx,
-                   significant_mi_ps.begin(), [](const auto &p) -> float {
-                     return std::log(p);
-                   }); // log-transform
-
-    std::pair<float, float> sol =
-        linearRegress(significant_mis, significant_mi_ps);
-    this->m = sol.first;
-    this->b = sol.second;
+    this->num_nulls = num_done;
+    this->nulls = null_mis.data();
   }
+
+  buildPValTable();
 }
 
 APMINullModel::~APMINullModel() {}
 
+/*
+ Writes the binary cache unless the nulls were mapped from it or interpolated.  The file is
+ written under a temporary name and renamed into place, so a concurrent run
+ never maps a partial cache.
+ */
 void APMINullModel::cacheNullModel(const std::string cached_dir) {
-  std::string nulls_filename =
-      cached_dir + nulls_filename_no_extension + ".txt";
-  std::string ols_filename =
-      cached_dir + OLS_coefs_filename_no_extension + ".txt";
-
-  if (!std::filesystem::exists(nulls_filename) ||
-      !std::filesystem::exists(ols_filename)) {
-    std::ofstream nulls_file(nulls_filename, std::ios::out | std::ios::binary);
-    std::ofstream OLS_coefs_file(ols_filename,
-                                 std::ios::out | std::ios::binary);
-    for (auto it = null_mis.cbegin(); it != null_mis.cend(); ++it)
-      nulls_file << *it << '\n';
-    OLS_coefs_file << m << '\n' << b << '\n';
+  const std::string cache_filename =
+      cached_dir + nulls_filename_no_extension + ".bin";
+  // interpolated models are not cached, so they never enter the library
+  if (mapping || library_lo != 0U)
+    return;
+
+  null_cache_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, null_cache_magic, sizeof(null_cache_magic));
+  header.version = null_cache_version;
+  header.tot_num_subsample = tot_num_subsample;
+  header.n_nulls = num_nulls;
+  header.q_thresh = apmi_default_policy::q_thresh;
+  header.size_thresh = apmi_default_policy::size_thresh;
+  header.m = m;
+  header.b = b;
+  header.alpha = alpha;
+  header.checksum = checksumNulls(nulls, num_nulls);
+
+  const std::string tmp_filename =
+      cache_filename + ".tmp" + std::to_string(std::random_device()());
+  {
+    std::ofstream cache_file(tmp_filename, std::ios::out | std::ios::binary);
+    cache_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    cache_file.write(reinterpret_cast<const char *>(nulls),
+                     num_nulls * sizeof(float));
+    if (!cache_file) {
+      std::cerr << "Warning: could not write null model cache \"" +
+                       cache_filename + "\"."
+                << std::endl;
+      cache_file.close();
+      std::filesystem::remove(tmp_filename);
+      return;
+    }
   }
+  std::filesystem::rename(tmp_filename, cache_filename);
   return;
 }
 
+const std::string APMINullModel::getDiagnostics() const {
+  std::string diagnostics =
+      std::to_string(num_nulls) + " nulls on " +
+      std::to_string(tot_num_subsample) + " samples";
+  if (adaptive)
+    diagnostics += num_batches == 0U
+                       ? " (adaptive, from cache)"
+                       : " (adaptive, " + std::to_string(num_batches) +
+                             " batches, " +
+                             (converged ? "converged" : "not converged") + ")";
+  if (library_lo != 0U)
+    diagnostics += " (interpolated from the library's N = " +
+                   std::to_string(library_lo) + " and N = " +
+                   std::to_string(library_hi) + ", null MI error <= " +
+                   std::to_string(interpolation_error) + " for p >= 0.001)";
+  return diagnostics + "; tail fit log(p) = " + std::to_string(m) +
+         " * MI + " + std::to_string(b) + " for p < 0.01";
+}
+
+/*
+ Builds the MI -> p lookup table.  Buckets are ranges of orderedKey(MI) of
+ width 2^PVAL_TABLE_SHIFT, i.e. of constant relative width in MI, so they are
+ finest where the nulls are sparse: in the tail most buckets hold at most one
+ null.  pval_table[q] is the number of nulls in buckets >= q, so the nulls of
+ bucket q are nulls[pval_table[q + 1], pval_table[q]).  At most
+ PVAL_TABLE_MAX_BUCKETS buckets are kept, covering the top of the range;
+ everything below falls into bucket 0.
+ */
+void APMINullModel::buildPValTable() {
+  const uint32_t key_hi = orderedKey(nulls[0]),
+                 key_range = key_hi - orderedKey(nulls[num_nulls - 1]);
+  const uint32_t num_buckets =
+      std::min((key_range >> PVAL_TABLE_SHIFT) + 1U, PVAL_TABLE_MAX_BUCKETS);
+  pval_table_key_lo = key_hi - ((num_buckets - 1U) << PVAL_TABLE_SHIFT);
+  pval_table.resize(num_buckets + 1U);
+
+  uint32_t i = 0U;
+  for (uint32_t q = num_buckets; q > 0U; --q) {
+    while (i < num_nulls && pValBucket(nulls[i]) >= q)
+      ++i;
+    pval_table[q] = i;
+  }
+  pval_table[0] = num_nulls;
+}
+
+/*
+ Bucket of mi in the lookup table.  Monotone in mi, so a null in a higher
+ bucket is > mi and a null in a lower bucket is < mi.
+ */
+uint32_t APMINullModel::pValBucket(const float mi) const {
+  const uint32_t key = orderedKey(mi);
+  if (key <= pval_table_key_lo)
+    return 0U;
+  return std::min<uint32_t>((key - pval_table_key_lo) >> PVAL_TABLE_SHIFT,
+                            pval_table.size() - 2U);
+}
+
+/*
+ The number of nulls >= mi is found by binary search within the nulls of
+ mi's bucket only, which gives exactly the result of a search over all nulls.
+ */
 const float APMINullModel::getMIPVal(const float &mi,
                                      const float &p_precise) const {
+  const uint32_t q = pValBucket(mi);
   // points to first index for which mi > the rest.
-  uint32_t n_nulls_gte = std::upper_bound(null_mis.cbegin(), null_mis.cend(), mi,
-                             std::greater<float>()) - null_mis.cbegin();
+  uint32_t n_nulls_gte =
+      std::upper_bound(nulls + pval_table[q + 1], nulls + pval_table[q], mi,
+                       std::greater<float>()) -
+      nulls;
 
   // p-value as a percentile.  We add 1 because it is an index
-  const float p = (n_nulls_gte + 1.f) / (null_mis.size() + 1.f);
+  const float p = (n_nulls_gte + 1.f) / (num_nulls + 1.f);
 
   if (p < p_precise)
     return std::exp(m * mi + b);
   else
     return p;
 }
+
+/*
+ Bisects for the keys (orderedKey) of the MIs where getMIPVal(MI, p_precise)
+ crosses p.  The eCDF p-value and the tail fit are each monotone in MI, so
+ each part is found by bisection over orderedKey(MI).  Returns the key from
+ which the tail fit is used, the smallest key of the tail with p-value < p,
+ and the smallest key below the tail with p-value < p; a key past
+ orderedKey(infinity) means none.  If the fit rises with MI, the tail's key is
+ the tail's start, a lower bound.
+ */
+std::tuple<uint64_t, uint64_t, uint64_t>
+APMINullModel::bisectPValKeys(const float p, const float p_precise) const {
+  const uint64_t key_min = orderedKey(-std::numeric_limits<float>::infinity()),
+                 key_max = orderedKey(std::numeric_limits<float>::infinity());
+  const auto ecdfP = [this](const float mi) {
+    const uint32_t q = pValBucket(mi);
+    const uint32_t n_nulls_gte =
+        std::upper_bound(nulls + pval_table[q + 1], nulls + pval_table[q], mi,
+                         std::greater<float>()) -
+        nulls;
+    return (n_nulls_gte + 1.f) / (num_nulls + 1.f);
+  };
+  // smallest key in [lo, hi] at which pred holds, or hi + 1 if none
+  const auto bisect = [](uint64_t lo, uint64_t hi, const auto &pred) {
+    ++hi;
+    while (lo < hi) {
+      const uint64_t mid = lo + (hi - lo) / 2U;
+      if (pred(floatOfKey(mid)))
+        hi = mid;
+      else
+        lo = mid + 1U;
+    }
+    return lo;
+  };
+
+  // the tail fit is used from tail_start on
+  const uint64_t tail_start = bisect(
+      key_min, key_max, [&](const float mi) { return ecdfP(mi) < p_precise; });
+  const uint64_t tail_thresh =
+      tail_start > key_max || m > 0.0f
+          ? tail_start
+          : bisect(tail_start, key_max,
+                   [&](const float mi) { return std::exp(m * mi + b) < p; });
+  const uint64_t ecdf_thresh =
+      tail_start == key_min
+          ? tail_start
+          : bisect(key_min, tail_start - 1U,
+                   [&](const float mi) { return ecdfP(mi) < p; });
+  return std::make_tuple(tail_start, tail_thresh, ecdf_thresh);
+}
+
+/*
+ Inverts getMIPVal: returns the MI t such that getMIPVal(mi, p_precise) < p if
+ and only if mi >= t, so edges can be filtered by one float compare.  Returns
+ infinity if no MI has p-value < p, and NaN if there is no such t.  That
+ happens only when p falls in the step at p_precise where the eCDF hands over
+ to the tail fit, and the fit there is above the eCDF.
+ */
+const float APMINullModel::getMIThreshold(const float &p,
+                                          const float &p_precise) const {
+  const uint64_t key_max =
+      orderedKey(std::numeric_limits<float>::infinity());
+  const auto [tail_start, tail_thresh, ecdf_thresh] =
+      bisectPValKeys(p, p_precise);
+  if (tail_start <= key_max && m > 0.0f)
+    return std::numeric_limits<float>::quiet_NaN();
+
+  uint64_t thresh;
+  if (ecdf_thresh < tail_start) {
+    // MIs from ecdf_thresh pass; every MI of the tail must pass too
+    if (tail_start <= key_max && tail_thresh != tail_start)
+      return std::numeric_limits<float>::quiet_NaN();
+    thresh = ecdf_thresh;
+  } else
+    thresh = tail_thresh;
+
+  return thresh > key_max ? std::numeric_limits<float>::infinity()
+                          : floatOfKey(thresh);
+}
+
+/*
+ A lower bound on the MI of anything with getMIPVal(MI, p_precise) < p: the
+ smallest such MI, or getMIThreshold(p) where that exists.  Infinity if no MI
+ has p-value < p.
+ */
+const float APMINullModel::getMIFloor(const float &p,
+                                      const float &p_precise) const {
+  const uint64_t key_max =
+      orderedKey(std::numeric_limits<float>::infinity());
+  const auto [tail_start, tail_thresh, ecdf_thresh] =
+      bisectPValKeys(p, p_precise);
+  const uint64_t floor = std::min(ecdf_thresh, tail_thresh);
+  return floor > key_max ? std::numeric_limits<float>::infinity()
+                         : floatOfKey(floor);
+}
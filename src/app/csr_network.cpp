@@ -0,0 +1,57 @@
+#include "csr_network.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+CSRNetwork::CSRNetwork() : offsets(1U, 0U) {}
+
+/*
+ Counting sort of the edges into rows, then a sort of each row by target.
+ */
+CSRNetwork::CSRNetwork(const std::vector<network_edge> &edges,
+                       const uint32_t num_rows)
+    : offsets(num_rows + 1U, 0U), targets(edges.size()), mis(edges.size()) {
+  for (const auto &[reg, tar, mi] : edges)
+    ++offsets[reg + 1U];
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+  std::vector<std::pair<gene_id, float>> row_edges(edges.size());
+  std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1U);
+  for (const auto &[reg, tar, mi] : edges)
+    row_edges[next[reg]++] = std::make_pair(tar, mi);
+
+  for (uint32_t reg = 0U; reg < num_rows; ++reg)
+    std::sort(row_edges.begin() + offsets[reg],
+              row_edges.begin() + offsets[reg + 1U],
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+  for (size_t e = 0U; e < row_edges.size(); ++e) {
+    targets[e] = row_edges[e].first;
+    mis[e] = row_edges[e].second;
+  }
+}
+
+uint32_t CSRNetwork::find(const gene_id reg, const gene_id tar) const {
+  const auto begin = targets.begin() + rowBegin(reg),
+             end = targets.begin() + rowEnd(reg);
+  const auto it = std::lower_bound(begin, end, tar);
+  return it != end && *it == tar ? it - targets.begin() : size();
+}
+
+CSRNetwork
+CSRNetwork::withoutEdges(const std::vector<uint64_t> &removed) const {
+  CSRNetwork kept;
+  kept.offsets.resize(offsets.size());
+  kept.targets.reserve(size());
+  kept.mis.reserve(size());
+  for (uint32_t reg = 0U; reg < numRows(); ++reg) {
+    for (uint32_t e = offsets[reg]; e < offsets[reg + 1U]; ++e)
+      if (!(removed[e / 64U] >> (e % 64U) & 1U)) {
+        kept.targets.push_back(targets[e]);
+        kept.mis.push_back(mis[e]);
+      }
+    kept.offsets[reg + 1U] = kept.targets.size();
+  }
+  kept.targets.shrink_to_fit();
+  kept.mis.shrink_to_fit();
+  return kept;
+}
@@ -2,6 +2,7 @@
 #include "ARACNe3.hpp"
 #include "algorithms.hpp"
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -40,40 +41,51 @@ void makeDir(const std::string &dir_name) {
 }
 
 /*
- Create a subsampled gene_to_floats.  Requires that exp_mat and
- tot_num_subsample are set.
+ Create a subsampled, re-ranked gene_to_shorts.  Requires that order_mat and
+ tot_num_subsample are set.  Each gene holds 1-based ranks on the subsample,
+ which stand for the copula values r / (tot_num_subsample + 1) and are consumed
+ directly by the rank-space calcAPMI.
+
+ Ties are broken once, at random, when the full data is ranked, and every
+ subnet shares that order; they are not re-broken per subsample.  (The same
+ holds for the copula-transformed matrix this replaces, whose values were all
+ distinct.)  So a gene's subsample order is its full-data order restricted to
+ the subsample: one linear scan of order_mat per gene, skipping unselected
+ samples, with no sorting.  rand only draws the subsample.
  */
-gene_to_floats
-sampleExpMatAndReCopulaTransform(const gene_to_floats &exp_mat,
+gene_to_shorts
+sampleExpMatAndReCopulaTransform(const gene_to_shorts &order_mat,
                                  const uint16_t &tot_num_subsample,
                                  std::mt19937 &rand) {
-  std::vector<uint16_t> idxs(exp_mat.cbegin()->size());
+  const uint16_t tot_num_samps = order_mat.cbegin()->size();
+  std::vector<uint16_t> idxs(tot_num_samps);
   std::iota(idxs.begin(), idxs.end(), 0U);
 
   std::vector<uint16_t> fold(tot_num_subsample);
   std::sample(idxs.begin(), idxs.end(), fold.begin(), tot_num_subsample, rand);
 
-  gene_to_floats subsample_exp_mat(exp_mat.size(),
-                                   std::vector<float>(tot_num_subsample, 0.f));
-  for (gene_id gene = 0U; gene < exp_mat.size(); ++gene) {
-    for (uint16_t i = 0U; i < tot_num_subsample; ++i)
-      subsample_exp_mat[gene][i] = exp_mat[gene][fold[i]];
-
-    std::vector<uint16_t> idx_ranks =
-        rankIndices(subsample_exp_mat[gene], rand);
-    for (uint16_t r = 0U; r < tot_num_subsample; ++r)
-      subsample_exp_mat[gene][idx_ranks[r]] =
-          (r + 1) / ((float)tot_num_subsample + 1);
+  // position of each sample in the fold, or UINT16_MAX if not selected
+  std::vector<uint16_t> fold_pos(tot_num_samps, UINT16_MAX);
+  for (uint16_t i = 0U; i < tot_num_subsample; ++i)
+    fold_pos[fold[i]] = i;
+
+  gene_to_shorts subsample_ranks_mat(
+      order_mat.size(), std::vector<uint16_t>(tot_num_subsample, 0U));
+  for (gene_id gene = 0U; gene < order_mat.size(); ++gene) {
+    uint16_t r = 0U;
+    for (const uint16_t samp : order_mat[gene])
+      if (fold_pos[samp] != UINT16_MAX)
+        subsample_ranks_mat[gene][fold_pos[samp]] = ++r;
   }
-  return subsample_exp_mat;
+  return subsample_ranks_mat;
 }
 
 /* Reads a normalized (CPM, TPM) tab-separated (G+1)x(N+1) gene expression
- * matrix and outputs a pair containing the gene_to_floats for the entire
- * expression matrix (non-subsampled) as well as a subsampled version for every
- * subnetwork.
+ * matrix and outputs, for the entire expression matrix (non-subsampled), each
+ * gene's samples in ascending order (from which subnetworks are subsampled)
+ * and each gene's 1-based ranks.
  */
-std::tuple<const gene_to_floats, const gene_to_shorts, const geneset,
+std::tuple<const gene_to_shorts, const gene_to_shorts, const geneset,
            const uint16_t>
 readExpMatrixAndCopulaTransform(const std::string &filename,
                                 std::mt19937 &rand) {
@@ -98,8 +110,7 @@ readExpMatrixAndCopulaTransform(const std::string &filename,
     ++tot_num_samps;
 
   uint32_t linesread = 1U;
-  gene_to_floats exp_mat;
-  gene_to_shorts ranks_mat;
+  gene_to_shorts order_mat, ranks_mat;
   while (std::getline(ifs, line, '\n')) {
     ++linesread;
     if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
@@ -129,23 +140,19 @@ readExpMatrixAndCopulaTransform(const std::string &filename,
       std::exit(1);
     }
 
-    // copula-transform expr_vec values
-    {
-      std::vector<uint16_t> idx_ranks = rankIndices(expr_vec, rand);
-      for (uint16_t r = 0; r < tot_num_samps; ++r) {
-        expr_vec[idx_ranks[r]] = (r + 1) / ((float)tot_num_samps + 1);
-        expr_ranks_vec[idx_ranks[r]] = r + 1;
-      }
-    }
+    // rank expr_vec values, breaking ties at random
+    std::vector<uint16_t> idx_ranks = rankIndices(expr_vec, rand);
+    for (uint16_t r = 0; r < tot_num_samps; ++r)
+      expr_ranks_vec[idx_ranks[r]] = r + 1;
 
-    // create compression scheme from exp_mat
+    // create compression scheme from gene names
     if (compression_map.find(gene) == compression_map.end()) {
       compression_map[gene] = decompression_map.size(); // str -> idx
       decompression_map.push_back(gene);                // idx -> str
       genes.insert(compression_map[gene]);
 
       // assumes index is same as the compression_map[gene]
-      exp_mat.emplace_back(expr_vec);
+      order_mat.emplace_back(idx_ranks);
       ranks_mat.emplace_back(expr_ranks_vec);
     } else {
       std::cerr << "Fatal: 2 rows corresponding to " + gene + " detected."
@@ -154,7 +161,7 @@ readExpMatrixAndCopulaTransform(const std::string &filename,
     }
   }
 
-  return std::make_tuple(exp_mat, ranks_mat, genes, tot_num_samps);
+  return std::make_tuple(order_mat, ranks_mat, genes, tot_num_samps);
 }
 
 /*
@@ -198,10 +205,10 @@ const geneset readRegList(const std::string &filename, const bool verbose) {
 
 /*
  Function that prints the Regulator, Target, and MI to the output_dir given the
- output_suffix.  Does not print to the console.  The data structure input is a
- gene_to_edge_tars, which is defined in "ARACNe3.hpp".
+ output_suffix.  Does not print to the console.  Edges are written by regulator
+ id, then target id.
  */
-void writeNetworkRegTarMI(gene_to_gene_to_float &network,
+void writeNetworkRegTarMI(const CSRNetwork &network,
                           const std::string &file_path) {
   std::ofstream ofs{file_path};
   if (!ofs) {
@@ -215,10 +222,11 @@ void writeNetworkRegTarMI(gene_to_gene_to_float &network,
   }
 
   ofs << "regulator.values\ttarget.values\tmi.values" << std::endl;
-  for (const auto &[reg, tar_mi] : network)
-    for (const auto [tar, mi] : tar_mi)
-      ofs << decompression_map[reg] << '\t' << decompression_map[tar] << '\t'
-          << mi << '\n';
+  for (uint32_t reg = 0U; reg < network.numRows(); ++reg)
+    for (uint32_t e = network.rowBegin(reg); e < network.rowEnd(reg); ++e)
+      ofs << decompression_map[reg] << '\t'
+          << decompression_map[network.target(e)] << '\t' << network.mi(e)
+          << '\n';
 }
 
 void writeConsolidatedNetwork(const std::vector<consolidated_df_row> &final_df,
@@ -255,6 +263,29 @@ void addToCompressionVecs(const std::string &gene) {
   }
 }
 
+/*
+ Writes subnet cur_subnet_ct to its subnet file in subnets_dir.
+ */
+void writeSubnetFile(const CSRNetwork &subnet, const std::string &subnets_dir,
+                     const uint16_t cur_subnet_ct, const std::string &runid) {
+  writeNetworkRegTarMI(subnet, subnets_dir + "subnet" +
+                                   std::to_string(cur_subnet_ct + 1) + "_" +
+                                   runid + ".tsv");
+}
+
+/*
+ Removes the subnet file and subnet log file of subnet cur_subnet_ct, e.g. one
+ generated speculatively but not needed.  Either may not have been written.
+ */
+void removeSubnetFiles(const std::string &subnets_dir,
+                       const std::string &subnets_log_dir,
+                       const uint16_t cur_subnet_ct, const std::string &runid) {
+  const std::string suffix =
+      std::to_string(cur_subnet_ct + 1) + "_" + runid;
+  std::filesystem::remove(subnets_dir + "subnet" + suffix + ".tsv");
+  std::filesystem::remove(subnets_log_dir + "log_subnet" + suffix + ".txt");
+}
+
 /*
  * Lists the files in the provided subnets dir and matches them to their log
  * files, assuming heterogeneous runids.  Returns a pair of string vectors that
@@ -306,7 +337,7 @@ findSubnetFilesAndSubnetLogFiles(const std::string &subnets_dir,
  Reads a subnet file and then updates the FPR_estimates vector defined in
  "subnet_operations.cpp"
  */
-std::pair<gene_to_gene_to_float, float>
+std::pair<CSRNetwork, float>
 loadARACNe3SubnetsAndUpdateFPRFromLog(const std::string &subnet_file_path,
                                       const std::string &subnet_log_file_path) {
   geneset regulators, genes;
@@ -334,7 +365,7 @@ loadARACNe3SubnetsAndUpdateFPRFromLog(const std::string &subnet_file_path,
   std::getline(subnet_ifs, line, '\n');
   if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
     line.pop_back();
-  gene_to_gene_to_float subnet;
+  std::vector<network_edge> edges;
   while (std::getline(subnet_ifs, line, '\n')) {
     if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
       line.pop_back();
@@ -355,7 +386,7 @@ loadARACNe3SubnetsAndUpdateFPRFromLog(const std::string &subnet_file_path,
     regulators.insert(compression_map[reg]);
     genes.insert(compression_map[tar]);
 
-    subnet[compression_map[reg]][compression_map[tar]] = mi;
+    edges.emplace_back(compression_map[reg], compression_map[tar], mi);
   }
 
   genes.insert(regulators.begin(), regulators.end());
@@ -378,63 +409,43 @@ loadARACNe3SubnetsAndUpdateFPRFromLog(const std::string &subnet_file_path,
     std::exit(2);
   }
 
-  // discard 8 lines
-  std::string discard;
-  for (uint8_t l = 0; l < 8; ++l)
-    std::getline(log_ifs, discard, '\n');
-
-  // next line contains the method
+  /*
+   Fields are found by their labels, so lines added to the subnet log do not
+   break consolidation.  The edge counts are the "Size of subnetwork" lines
+   after each pruning step.
+   */
   std::string method;
-  std::getline(log_ifs, line, '\n');
-  if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
-    line.pop_back();
-  if (line.find("FDR") != std::string::npos)
-    method = "FDR";
-  else if (line.find("FWER") != std::string::npos)
-    method = "FWER";
-  else if (line.find("FPR") != std::string::npos)
-    method = "FPR";
-
-  // next line contains alpha
-  float alpha;
-  std::getline(log_ifs, line, '\n');
-  if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
-    line.pop_back();
-  std::stringstream line_stream(line);
-  line_stream >> discard >> alpha;
-
-  // next line contains whether we have MaxEnt pruning
-  std::string prune_MaxEnt_str;
-  std::getline(log_ifs, line, '\n');
-  if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
-    line.pop_back();
-  line_stream = std::stringstream(line);
-  line_stream >> discard >> discard >> prune_MaxEnt_str;
-  bool prune_MaxEnt;
-  prune_MaxEnt = (prune_MaxEnt_str == "true") ? true : false;
-
-  // skip 8 lines
-  for (uint8_t l = 0U; l < 8U; ++l)
-    std::getline(log_ifs, discard, '\n');
-  std::getline(log_ifs, line, '\n');
-  if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
-    line.pop_back();
-  line_stream = std::stringstream(line);
-  uint32_t num_edges_after_threshold_pruning = 0U;
-  line_stream >> discard >> discard >> discard >>
-      num_edges_after_threshold_pruning;
-
-  // skip 3 lines, the 4th contains edges after MaxEnt pruning
-  uint32_t num_edges_after_MaxEnt_pruning = 0U;
-  if (prune_MaxEnt) {
-    for (uint8_t l = 0U; l < 3U; ++l)
-      std::getline(log_ifs, discard, '\n');
-    std::getline(log_ifs, line, '\n');
-    if (line.back() == '\r') /* Alert! We have a Windows dweeb! */
-      line.pop_back();
-    line_stream = std::stringstream(line);
-    line_stream >> discard >> discard >> discard >>
-        num_edges_after_MaxEnt_pruning;
+  float alpha = 0.0f;
+  bool prune_MaxEnt = false;
+  uint32_t num_edges_after_threshold_pruning = 0U,
+           num_edges_after_MaxEnt_pruning = 0U;
+  uint32_t *next_size = nullptr;
+  const auto startsWith = [&line](const std::string &label) -> bool {
+    return line.compare(0U, label.size(), label) == 0;
+  };
+  const std::string size_label = "Size of subnetwork: ";
+  while (std::getline(log_ifs, line, '\n')) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back(); /* Alert! We have a Windows dweeb! */
+    if (startsWith("Method of first pruning step: ")) {
+      if (line.find("FDR") != std::string::npos)
+        method = "FDR";
+      else if (line.find("FWER") != std::string::npos)
+        method = "FWER";
+      else if (line.find("FPR") != std::string::npos)
+        method = "FPR";
+    } else if (startsWith("Alpha: ")) {
+      alpha = std::stof(line.substr(std::strlen("Alpha: ")));
+    } else if (startsWith("MaxEnt Pruning: ")) {
+      prune_MaxEnt = line.find("true") != std::string::npos;
+    } else if (startsWith("Threshold pruning time")) {
+      next_size = &num_edges_after_threshold_pruning;
+    } else if (startsWith("MaxEnt pruning time")) {
+      next_size = &num_edges_after_MaxEnt_pruning;
+    } else if (next_size && startsWith(size_label)) {
+      *next_size = std::stoul(line.substr(size_label.size()));
+      next_size = nullptr;
+    }
   }
 
   float FPR_estimate_subnet;
@@ -461,5 +472,6 @@ loadARACNe3SubnetsAndUpdateFPRFromLog(const std::string &subnet_file_path,
       FPR_estimate_subnet = alpha;
   }
 
-  return std::make_pair(subnet, FPR_estimate_subnet);
+  return std::make_pair(CSRNetwork(edges, decompression_map.size()),
+                        FPR_estimate_subnet);
 }
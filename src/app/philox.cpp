@@ -0,0 +1,39 @@
+#include "philox.hpp"
+
+static constexpr uint32_t PHILOX_M0 = 0xD2511F53U, PHILOX_M1 = 0xCD9E8D57U,
+                          PHILOX_W0 = 0x9E3779B9U, PHILOX_W1 = 0xBB67AE85U;
+
+/*
+ Counter words 0 and 1 count blocks within a stream, words 2 and 3 hold the
+ stream.
+ */
+Philox4x32::Philox4x32(const uint64_t key, const uint64_t stream)
+    : key{static_cast<uint32_t>(key), static_cast<uint32_t>(key >> 32U)},
+      counter{0U, 0U, static_cast<uint32_t>(stream),
+              static_cast<uint32_t>(stream >> 32U)},
+      block{0U, 0U, 0U, 0U}, next(4U) {}
+
+void Philox4x32::refill() {
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3],
+           k0 = key[0], k1 = key[1];
+  for (uint8_t round = 0U; round < 10U; ++round) {
+    const uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * c0,
+                   p1 = static_cast<uint64_t>(PHILOX_M1) * c2;
+    const uint32_t hi0 = p0 >> 32U, lo0 = p0, hi1 = p1 >> 32U, lo1 = p1;
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  block[0] = c0;
+  block[1] = c1;
+  block[2] = c2;
+  block[3] = c3;
+  next = 0U;
+
+  // advance the 64-bit block count of this stream
+  if (++counter[0] == 0U)
+    ++counter[1];
+}
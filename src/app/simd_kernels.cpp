@@ -0,0 +1,230 @@
+#include "simd_kernels.hpp"
+
+#include <cstdint>
+
+#if (defined __x86_64__ || defined __i386__) &&                                \
+    (defined __GNUC__ || defined __clang__)
+#define ARACNE3_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+typedef uint16_t (*split_kernel)(const uint16_t *, const uint16_t *,
+                                 const uint16_t, const uint16_t, uint16_t *,
+                                 uint16_t *, uint16_t *, uint16_t *);
+
+/*
+ Portable kernel.  Both destinations are written for every point and only the
+ matching one advances, so there is no data-dependent branch.
+ */
+static uint16_t splitByYScalar(const uint16_t *pts, const uint16_t *ys,
+                               const uint16_t num, const uint16_t thresh,
+                               uint16_t *bottom_pts, uint16_t *bottom_ys,
+                               uint16_t *top_pts, uint16_t *top_ys) {
+  uint16_t num_bottom = 0U, num_top = 0U;
+  for (uint16_t i = 0U; i < num; ++i) {
+    const uint16_t p = pts[i], y = ys[i];
+    const bool top = y >= thresh;
+    bottom_pts[num_bottom] = p;
+    bottom_ys[num_bottom] = y;
+    top_pts[num_top] = p;
+    top_ys[num_top] = y;
+    num_bottom += !top;
+    num_top += top;
+  }
+  return num_bottom;
+}
+
+#ifdef ARACNE3_X86_DISPATCH
+
+/*
+ AVX2 has no compress instruction, so 8 16-bit lanes are left-packed with
+ pshufb, using a shuffle control per 8-bit lane mask.
+ */
+static uint8_t pack_lut[256][16];
+
+static bool initPackLUT() {
+  for (uint16_t mask = 0U; mask < 256U; ++mask) {
+    uint8_t out = 0U;
+    for (uint8_t lane = 0U; lane < 8U; ++lane)
+      if (mask & (1U << lane)) {
+        pack_lut[mask][2U * out] = 2U * lane;
+        pack_lut[mask][2U * out + 1U] = 2U * lane + 1U;
+        ++out;
+      }
+    for (; out < 8U; ++out)
+      pack_lut[mask][2U * out] = pack_lut[mask][2U * out + 1U] = 0x80U;
+  }
+  return true;
+}
+
+__attribute__((target("avx2,popcnt"))) static inline void
+packStore(const __m128i pts, const __m128i ys, const uint32_t mask,
+          uint16_t *out_pts, uint16_t *out_ys) {
+  const __m128i ctrl =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(pack_lut[mask]));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out_pts),
+                   _mm_shuffle_epi8(pts, ctrl));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out_ys),
+                   _mm_shuffle_epi8(ys, ctrl));
+}
+
+/*
+ 16 points per iteration.  Full 8-lane stores land at or behind the block being
+ read, so the in-place bottom output never overwrites unread points.
+ */
+__attribute__((target("avx2,popcnt"))) static uint16_t
+splitByYAVX2(const uint16_t *pts, const uint16_t *ys, const uint16_t num,
+             const uint16_t thresh, uint16_t *bottom_pts, uint16_t *bottom_ys,
+             uint16_t *top_pts, uint16_t *top_ys) {
+  const __m256i t = _mm256_set1_epi16(static_cast<int16_t>(thresh));
+  uint16_t num_bottom = 0U, num_top = 0U, i = 0U;
+  for (; i + 16U <= num; i += 16U) {
+    const __m256i p =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pts + i));
+    const __m256i y =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ys + i));
+    // unsigned y >= thresh  <=>  max(y, thresh) == y
+    const __m256i top = _mm256_cmpeq_epi16(_mm256_max_epu16(y, t), y);
+    const uint32_t top_mask = _mm_movemask_epi8(_mm_packs_epi16(
+                       _mm256_castsi256_si128(top),
+                       _mm256_extracti128_si256(top, 1))),
+                   bottom_mask = ~top_mask & 0xFFFFU;
+
+    const __m128i p_lo = _mm256_castsi256_si128(p),
+                  p_hi = _mm256_extracti128_si256(p, 1),
+                  y_lo = _mm256_castsi256_si128(y),
+                  y_hi = _mm256_extracti128_si256(y, 1);
+
+    packStore(p_lo, y_lo, bottom_mask & 0xFFU, bottom_pts + num_bottom,
+              bottom_ys + num_bottom);
+    num_bottom += _mm_popcnt_u32(bottom_mask & 0xFFU);
+    packStore(p_hi, y_hi, bottom_mask >> 8U, bottom_pts + num_bottom,
+              bottom_ys + num_bottom);
+    num_bottom += _mm_popcnt_u32(bottom_mask >> 8U);
+
+    packStore(p_lo, y_lo, top_mask & 0xFFU, top_pts + num_top,
+              top_ys + num_top);
+    num_top += _mm_popcnt_u32(top_mask & 0xFFU);
+    packStore(p_hi, y_hi, top_mask >> 8U, top_pts + num_top, top_ys + num_top);
+    num_top += _mm_popcnt_u32(top_mask >> 8U);
+  }
+  return num_bottom + splitByYScalar(pts + i, ys + i, num - i, thresh,
+                                     bottom_pts + num_bottom,
+                                     bottom_ys + num_bottom, top_pts + num_top,
+                                     top_ys + num_top);
+}
+
+/*
+ AVX-512 compress-stores.  16-bit compress needs VBMI2, which many of our nodes
+ lack, so lanes are widened to 32 bits for vpcompressd and narrowed back.  The
+ zero-masked conversions are used with all lanes set because the unmasked ones
+ start from an undefined vector, which -Wall reports as maybe-uninitialized.
+ */
+static constexpr __mmask16 ALL_LANES = 0xFFFFU;
+
+__attribute__((target("avx512f,avx512bw,avx512vl,popcnt"))) static inline void
+compressStore(const __m512i wide, const __mmask16 mask, uint16_t *out) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+                      _mm512_maskz_cvtepi32_epi16(
+                          ALL_LANES, _mm512_maskz_compress_epi32(mask, wide)));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl,popcnt"))) static uint16_t
+splitByYAVX512(const uint16_t *pts, const uint16_t *ys, const uint16_t num,
+               const uint16_t thresh, uint16_t *bottom_pts, uint16_t *bottom_ys,
+               uint16_t *top_pts, uint16_t *top_ys) {
+  const __m256i t = _mm256_set1_epi16(static_cast<int16_t>(thresh));
+  uint16_t num_bottom = 0U, num_top = 0U, i = 0U;
+  for (; i + 16U <= num; i += 16U) {
+    const __m256i p =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pts + i));
+    const __m256i y =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ys + i));
+    const __mmask16 top_mask = _mm256_cmpge_epu16_mask(y, t),
+                    bottom_mask = ~top_mask;
+    const __m512i p_wide = _mm512_maskz_cvtepu16_epi32(ALL_LANES, p),
+                  y_wide = _mm512_maskz_cvtepu16_epi32(ALL_LANES, y);
+
+    compressStore(p_wide, bottom_mask, bottom_pts + num_bottom);
+    compressStore(y_wide, bottom_mask, bottom_ys + num_bottom);
+    compressStore(p_wide, top_mask, top_pts + num_top);
+    compressStore(y_wide, top_mask, top_ys + num_top);
+    num_bottom += _mm_popcnt_u32(bottom_mask);
+    num_top += _mm_popcnt_u32(top_mask);
+  }
+  return num_bottom + splitByYScalar(pts + i, ys + i, num - i, thresh,
+                                     bottom_pts + num_bottom,
+                                     bottom_ys + num_bottom, top_pts + num_top,
+                                     top_ys + num_top);
+}
+
+#endif /* ARACNE3_X86_DISPATCH */
+
+typedef struct {
+  const std::string name;
+  const split_kernel kernel;
+  const bool available;
+} split_kernel_entry;
+
+static const std::vector<split_kernel_entry> &splitKernels() {
+  static const std::vector<split_kernel_entry> kernels = [] {
+    std::vector<split_kernel_entry> k;
+#ifdef ARACNE3_X86_DISPATCH
+    __builtin_cpu_init();
+    static const bool lut_ready = initPackLUT();
+    k.push_back({"avx512", splitByYAVX512,
+                 __builtin_cpu_supports("avx512f") &&
+                     __builtin_cpu_supports("avx512bw") &&
+                     __builtin_cpu_supports("avx512vl")});
+    k.push_back({"avx2", splitByYAVX2,
+                 lut_ready && __builtin_cpu_supports("avx2") &&
+                     __builtin_cpu_supports("popcnt")});
+#endif
+    k.push_back({"scalar", splitByYScalar, true});
+    return k;
+  }();
+  return kernels;
+}
+
+static const split_kernel_entry *bestSplitKernel() {
+  for (const auto &entry : splitKernels())
+    if (entry.available)
+      return &entry;
+  return &splitKernels().back();
+}
+
+static const split_kernel_entry *cur_split_kernel = bestSplitKernel();
+
+uint16_t splitByY(const uint16_t *pts, const uint16_t *ys, const uint16_t num,
+                  const uint32_t thresh, uint16_t *bottom_pts,
+                  uint16_t *bottom_ys, uint16_t *top_pts, uint16_t *top_ys) {
+  // a threshold above every rank sends every point to the bottom
+  if (thresh > UINT16_MAX) {
+    for (uint16_t i = 0U; i < num; ++i) {
+      bottom_pts[i] = pts[i];
+      bottom_ys[i] = ys[i];
+    }
+    return num;
+  }
+  return cur_split_kernel->kernel(pts, ys, num, thresh, bottom_pts, bottom_ys,
+                                  top_pts, top_ys);
+}
+
+const std::string &splitKernelName() { return cur_split_kernel->name; }
+
+std::vector<std::string> availableSplitKernels() {
+  std::vector<std::string> names;
+  for (const auto &entry : splitKernels())
+    if (entry.available)
+      names.push_back(entry.name);
+  return names;
+}
+
+bool useSplitKernel(const std::string &name) {
+  for (const auto &entry : splitKernels())
+    if (entry.available && entry.name == name) {
+      cur_split_kernel = &entry;
+      return true;
+    }
+  return false;
+}
@@ -0,0 +1,78 @@
+#include "subnet_accumulator.hpp"
+
+#include <algorithm>
+
+const std::vector<gene_id> SubnetAccumulator::no_targets;
+const std::vector<uint16_t> SubnetAccumulator::no_counts;
+
+SubnetAccumulator::SubnetAccumulator()
+    : num_regulons_of_size(UINT16_MAX + 2U, 0U), num_subnets(0U),
+      FPR_estimate_sum(0.0f) {}
+
+/*
+ Each row of the subnet is merged into the sorted union of that regulator's
+ targets; rows are independent, so they are merged in parallel.
+ */
+void SubnetAccumulator::add(const CSRNetwork &subnet, const float FPR_estimate,
+                            const uint16_t nthreads) {
+  if (subnet.numRows() > numRows()) {
+    targets.resize(subnet.numRows());
+    counts.resize(subnet.numRows());
+  }
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 64)
+  for (uint32_t reg = 0U; reg < subnet.numRows(); ++reg) {
+    const uint32_t begin = subnet.rowBegin(reg), end = subnet.rowEnd(reg);
+    if (begin == end)
+      continue;
+
+    const std::vector<gene_id> &old_targets = targets[reg];
+    const std::vector<uint16_t> &old_counts = counts[reg];
+    std::vector<gene_id> new_targets;
+    std::vector<uint16_t> new_counts;
+    new_targets.reserve(old_targets.size() + (end - begin));
+    new_counts.reserve(old_targets.size() + (end - begin));
+
+    size_t i = 0U;
+    uint32_t e = begin;
+    while (i < old_targets.size() || e < end) {
+      if (e == end || (i < old_targets.size() &&
+                       old_targets[i] < subnet.target(e))) {
+        new_targets.push_back(old_targets[i]);
+        new_counts.push_back(old_counts[i++]);
+      } else if (i == old_targets.size() ||
+                 subnet.target(e) < old_targets[i]) {
+        new_targets.push_back(subnet.target(e++));
+        new_counts.push_back(1U);
+      } else {
+        new_targets.push_back(old_targets[i]);
+        new_counts.push_back(old_counts[i++] + 1U);
+        ++e;
+      }
+    }
+
+    if (new_targets.size() != old_targets.size()) {
+      if (!old_targets.empty()) {
+#pragma omp atomic
+        --num_regulons_of_size[old_targets.size()];
+      }
+#pragma omp atomic
+      ++num_regulons_of_size[new_targets.size()];
+    }
+
+    new_targets.shrink_to_fit();
+    new_counts.shrink_to_fit();
+    targets[reg] = std::move(new_targets);
+    counts[reg] = std::move(new_counts);
+  }
+
+  FPR_estimate_sum += FPR_estimate;
+  ++num_subnets;
+}
+
+uint16_t SubnetAccumulator::minRegulonSize() const {
+  for (uint32_t size = 1U; size < UINT16_MAX; ++size)
+    if (num_regulons_of_size[size] > 0U)
+      return size;
+  return UINT16_MAX;
+}
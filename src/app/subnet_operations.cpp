@@ -2,182 +2,250 @@
 #include "ARACNe3.hpp"
 #include "algorithms.hpp"
 #include "apmi_nullmodel.hpp"
+#include "csr_network.hpp"
 #include "io.hpp"
 #include "stopwatch.hpp"
 
 #include <boost/math/distributions/beta.hpp>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <numeric>
 #include <omp.h>
-#include <set>
+
+/*
+ The p-value below which an edge can pass threshold pruning: alpha / m for
+ FWER, and alpha for FPR and for FDR, where p_k < k * alpha / m < alpha.
+ */
+static float pruneAlphaPCutoff(const std::string &method, const float alpha,
+                               const uint32_t size_of_network) {
+  return method == "FWER" ? alpha / size_of_network : alpha;
+}
 
 /*
  Prunes a network by control of alpha using the Benjamini-Hochberg Procedure if
  method = FDR, or FWER if method = FWER.
+
+ reg_tar_mi holds the edges of a network of size_of_network edges that have
+ MI >= nullmodel.getMIFloor(pruneAlphaPCutoff(...)); weaker edges cannot pass
+ and need not be given.  Edges are ranked by MI, so the edges that matter are
+ a prefix: the candidates at least as strong as the weakest edge with p below
+ the cutoff.  The null model maps the p cutoff to an MI, so candidates are
+ found by one float compare per edge (or, where no MI cutoff is equivalent,
+ from the weakest edge that passes), in parallel chunks that keep their order.
+ FWER and FPR keep every candidate, unsorted.  For FDR only the candidates are
+ sorted, and BH walks them; their ranks k are their ranks in the full network.
+ The edges kept are returned as a network of num_rows rows.
  */
-std::tuple<gene_to_gene_to_float, uint32_t, gene_to_gene_to_float>
-pruneAlpha(const gene_to_gene_to_float &network, const geneset &regulators,
-           uint32_t size_of_network, const std::string &method,
-           const float alpha, const APMINullModel &nullmodel) {
-
-  /* A vector that describes each regulator-mi-target interaction must be
-   * initialized for sorting-based pruning */
-  std::vector<std::tuple<gene_id, gene_id, float>> reg_tar_mi;
-  reg_tar_mi.reserve(size_of_network);
-
-  for (gene_id reg : regulators)
-    for (const auto [tar, mi] : network.at(reg))
-      reg_tar_mi.emplace_back(reg, tar, mi);
-
-  // sort descending
-  std::sort(reg_tar_mi.begin(), reg_tar_mi.end(),
-            [](const std::tuple<gene_id, gene_id, float> &rtm1,
-               const std::tuple<gene_id, gene_id, float> &rtm2) -> bool {
-              return std::get<2>(rtm1) > std::get<2>(rtm2);
-            });
+CSRNetwork pruneAlpha(std::vector<network_edge> reg_tar_mi,
+                      const uint32_t num_rows, uint32_t size_of_network,
+                      const std::string &method, const float alpha,
+                      const APMINullModel &nullmodel, const uint16_t nthreads,
+                      prune_alpha_stats &stats) {
+  double step_start = omp_get_wtime();
 
-  uint32_t argmax_k = 0U;
   uint32_t m = size_of_network;
+  const float p_cutoff = pruneAlphaPCutoff(method, alpha, m);
+
+  float min_candidate_mi = nullmodel.getMIThreshold(p_cutoff);
+  if (std::isnan(min_candidate_mi)) {
+    min_candidate_mi = std::numeric_limits<float>::infinity();
+#pragma omp parallel for num_threads(nthreads) reduction(min : min_candidate_mi)
+    for (size_t i = 0U; i < reg_tar_mi.size(); ++i) {
+      const float mi = std::get<2>(reg_tar_mi[i]);
+      if (mi < min_candidate_mi && nullmodel.getMIPVal(mi) < p_cutoff)
+        min_candidate_mi = mi;
+    }
+  }
+  const auto isCandidate = [min_candidate_mi](const network_edge &rtm) {
+    return std::get<2>(rtm) >= min_candidate_mi;
+  };
+
+  // each thread counts, then copies, the candidates of its chunk of edges
+  std::vector<network_edge> candidates;
+  std::vector<size_t> chunk_offsets(nthreads + 1U, 0U);
+#pragma omp parallel num_threads(nthreads)
+  {
+    const size_t th = omp_get_thread_num(), team_size = omp_get_num_threads(),
+                 begin = reg_tar_mi.size() * th / team_size,
+                 end = reg_tar_mi.size() * (th + 1U) / team_size;
+    chunk_offsets[th + 1U] =
+        std::count_if(reg_tar_mi.begin() + begin, reg_tar_mi.begin() + end,
+                      isCandidate);
+#pragma omp barrier
+#pragma omp single
+    {
+      std::partial_sum(chunk_offsets.begin(),
+                       chunk_offsets.begin() + team_size + 1U,
+                       chunk_offsets.begin());
+      candidates.resize(chunk_offsets[team_size]);
+    }
+    std::copy_if(reg_tar_mi.begin() + begin, reg_tar_mi.begin() + end,
+                 candidates.begin() + chunk_offsets[th], isCandidate);
+  }
+  std::vector<network_edge>().swap(reg_tar_mi);
+  stats.num_candidates = candidates.size();
+  stats.filter_secs = omp_get_wtime() - step_start;
+  step_start = omp_get_wtime();
+
+  // sort descending; ties by regulator and target, so the order does not
+  // depend on the order edges arrive in
+  if (method == "FDR")
+    std::sort(candidates.begin(), candidates.end(),
+              [](const network_edge &rtm1, const network_edge &rtm2) -> bool {
+                if (std::get<2>(rtm1) != std::get<2>(rtm2))
+                  return std::get<2>(rtm1) > std::get<2>(rtm2);
+                return std::tie(std::get<0>(rtm1), std::get<1>(rtm1)) <
+                       std::tie(std::get<0>(rtm2), std::get<1>(rtm2));
+              });
+  stats.sort_secs = omp_get_wtime() - step_start;
+  step_start = omp_get_wtime();
+
+  uint32_t argmax_k = 0U;
   if (method == "FDR") {
     // Benjamini-Hochberg
-    for (auto it = reg_tar_mi.begin(); it != reg_tar_mi.end(); ++it) {
-      const auto k = it - reg_tar_mi.begin();
+    for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+      const auto k = it - candidates.begin();
       const float p_k = nullmodel.getMIPVal(std::get<2>(*it));
       if (p_k < k * alpha / m)
         argmax_k = static_cast<uint32_t>(k) + 1;
     }
-  } else if (method == "FWER") {
-    for (auto it = reg_tar_mi.begin(); it != reg_tar_mi.end(); ++it) {
-      const auto k = it - reg_tar_mi.begin();
-      const float p_k = nullmodel.getMIPVal(std::get<2>(*it));
-      if (p_k < alpha / m)
-        argmax_k = static_cast<uint32_t>(k) + 1;
-    }
-  } else if (method == "FPR") {
-    // Only for benchmarking
-    for (auto it = reg_tar_mi.begin(); it != reg_tar_mi.end(); ++it) {
-      const auto k = it - reg_tar_mi.begin();
-      const float p_k = nullmodel.getMIPVal(std::get<2>(*it));
-      if (p_k < alpha)
-        argmax_k = static_cast<uint32_t>(k) + 1;
-    }
+  } else if (method == "FWER" || method == "FPR") {
+    // FPR only for benchmarking
+    argmax_k = candidates.size();
   }
+  stats.cutoff_secs = omp_get_wtime() - step_start;
+  step_start = omp_get_wtime();
 
-  // create the new vector that is a pruned version of original
-  std::vector<std::tuple<gene_id, gene_id, float>> pruned_vec(
-      &reg_tar_mi[0], &reg_tar_mi[argmax_k]);
-
-  // rebuild network
-  size_of_network = pruned_vec.size();
-  gene_to_gene_to_float pruned_net;
-  gene_to_gene_to_float pruned_net_reg_reg_only;
-
-  pruned_net.reserve(regulators.size());
-  pruned_net_reg_reg_only.reserve(regulators.size());
-
-  for (const auto [reg, tar, mi] : pruned_vec) {
-    pruned_net[reg][tar] = mi;
-    if (regulators.find(tar) != regulators.end())
-      pruned_net_reg_reg_only[reg][tar] = mi;
-  }
+  // rebuild network from the edges kept
+  candidates.resize(argmax_k);
+  CSRNetwork pruned_net(candidates, num_rows);
+  stats.rebuild_secs = omp_get_wtime() - step_start;
 
-  return std::make_tuple(pruned_net, size_of_network, pruned_net_reg_reg_only);
+  return pruned_net;
 }
 
 /*
  Prune the network according to the MaxEnt weakest-edge reduction.
- */
-std::pair<gene_to_gene_to_float, uint32_t>
-pruneMaxEnt(gene_to_gene_to_float network, uint32_t size_of_network,
-            const geneset &regulators,
-            gene_to_gene_to_float network_reg_reg_only,
-            const uint16_t nthreads) {
-
-  gene_to_geneset edges_to_remove;
-  edges_to_remove.reserve(regulators.size());
-
-  // make unique data structure that stores redundant edges
-  std::set<std::pair<gene_id, gene_id>> to_remove;  // can't use unordered because hash fn not defined for pair; set is binary tree
-  for (const auto [reg1, reg2_mi] : network_reg_reg_only)
-    for (const auto [reg2, mi_regs] : reg2_mi)
-      if (to_remove.find(std::make_pair(reg1, reg2)) == to_remove.end() &&
-          to_remove.find(std::make_pair(reg2, reg1)) == to_remove.end())
-        to_remove.insert(std::make_pair(reg2, reg1));
-
-  // make into triangular matrix (remove all reg from all reg2 targets regulon)
-  for (const auto &[reg1, reg2] : to_remove)
-    network_reg_reg_only.at(reg1).erase(reg2);
 
-#pragma omp parallel num_threads(nthreads)
+ Triangles are a regulator-regulator edge plus a target shared by both
+ regulons.  Each regulator pair is visited once, from its smaller regulator,
+ through the regulator's sorted row.  The edges of reg1 are indexed by target
+ in a dense array, so the shared targets are found with one pass over reg2's
+ row.  Every triangle is judged on the network as given, so each thread only
+ marks edges in its own removal bitmap.  The bitmaps are OR-ed word by word in
+ parallel, with no locks, and the marked edges are removed in one pass.
+ */
+CSRNetwork pruneMaxEnt(const CSRNetwork &network, const geneset &regulators,
+                       const uint16_t nthreads, prune_MaxEnt_stats &stats) {
+  double step_start = omp_get_wtime();
+
+  const std::vector<gene_id> regs_vec(regulators.begin(), regulators.end());
+  std::vector<bool> is_regulator(network.numRows(), false);
+  for (const gene_id reg : regs_vec)
+    if (reg < network.numRows())
+      is_regulator[reg] = true;
+
+  const uint32_t num_words = (network.size() + 63U) / 64U;
+  std::vector<std::vector<uint64_t>> thread_removed(nthreads);
+  uint64_t num_reg_pairs = 0U, num_triangles = 0U;
+  // the team may have fewer than nthreads threads (e.g. nested or limited)
+  uint16_t team_size = 1U;
+
+#pragma omp parallel num_threads(nthreads)                                     \
+    reduction(+ : num_reg_pairs, num_triangles)
   {
-    // Local version for each thread
-    gene_to_geneset local_edges_to_remove;
-
-    // schedule in skips as opposed to chunks, faster now
-#pragma omp for schedule(static, 1)
-    for (uint32_t i = 0U; i < network_reg_reg_only.size(); ++i) {
-      auto it = network_reg_reg_only.cbegin();
-      std::advance(it, i);
-      const uint16_t reg1 = it->first;
-      const gene_to_float &reg2_mi = it->second;
-
-      const gene_to_float &reg1_regulon = network.at(reg1);
-      geneset &remove_from_reg1 = local_edges_to_remove[reg1];
-
-      for (const auto [reg2, mi_regs] : reg2_mi) {
-        // check if reg2 has regulon
-        if (network.find(reg2) != network.end()) {
-          const gene_to_float &reg2_regulon = network.at(reg2);
-          geneset &remove_from_reg2 = local_edges_to_remove[reg2];
-
-          for (const auto [tar, mi_reg1_tar] : reg1_regulon) {
-
-            if (reg2_regulon.find(tar) != reg2_regulon.end()) {
-              const float mi_reg2_tar = reg2_regulon.at(tar);
-              if (mi_reg1_tar < mi_regs && mi_reg1_tar < mi_reg2_tar)
-                remove_from_reg1.insert(tar);
-              else if (mi_reg2_tar < mi_regs && mi_reg2_tar < mi_reg1_tar)
-                remove_from_reg2.insert(tar);
-              else {
-                remove_from_reg1.insert(reg2);
-                remove_from_reg2.insert(reg1);
-              }
-            }
+#pragma omp single nowait
+    team_size = omp_get_num_threads();
+    std::vector<uint64_t> &removed = thread_removed[omp_get_thread_num()];
+    removed.assign(num_words, 0U);
+    const auto mark = [&removed](const uint32_t e) {
+      removed[e / 64U] |= uint64_t{1} << (e % 64U);
+    };
+    // reg1's edge to each target, or network.size() if there is none
+    std::vector<uint32_t> reg1_edge_to(network.numRows(), network.size());
+
+#pragma omp for schedule(dynamic)
+    for (size_t i = 0U; i < regs_vec.size(); ++i) {
+      const gene_id reg1 = regs_vec[i];
+      const uint32_t reg1_begin = network.rowBegin(reg1),
+                     reg1_end = network.rowEnd(reg1);
+      for (uint32_t e = reg1_begin; e < reg1_end; ++e)
+        reg1_edge_to[network.target(e)] = e;
+
+      for (uint32_t e_regs = reg1_begin; e_regs < reg1_end; ++e_regs) {
+        const gene_id reg2 = network.target(e_regs);
+        if (!is_regulator[reg2])
+          continue;
+        // the reg-reg edges are symmetric; visit from the smaller regulator
+        const uint32_t e_regs_rev = network.find(reg2, reg1);
+        if (reg2 < reg1 && e_regs_rev != network.size())
+          continue;
+        ++num_reg_pairs;
+        const float mi_regs = network.mi(e_regs);
+
+        for (uint32_t e2 = network.rowBegin(reg2); e2 < network.rowEnd(reg2);
+             ++e2) {
+          const uint32_t e1 = reg1_edge_to[network.target(e2)];
+          if (e1 == network.size())
+            continue;
+          ++num_triangles;
+
+          const float mi_reg1_tar = network.mi(e1),
+                      mi_reg2_tar = network.mi(e2);
+          if (mi_reg1_tar < mi_regs && mi_reg1_tar < mi_reg2_tar)
+            mark(e1);
+          else if (mi_reg2_tar < mi_regs && mi_reg2_tar < mi_reg1_tar)
+            mark(e2);
+          else {
+            mark(e_regs);
+            if (e_regs_rev != network.size())
+              mark(e_regs_rev);
           }
         }
       }
-    }
 
-// Merging local results into global result
-#pragma omp critical
-    {
-      for (const auto &[reg, remove_set] : local_edges_to_remove) {
-        edges_to_remove[reg].insert(remove_set.begin(), remove_set.end());
-      }
+      for (uint32_t e = reg1_begin; e < reg1_end; ++e)
+        reg1_edge_to[network.target(e)] = network.size();
     }
   }
-
-  for (const auto &[reg, remove_from_reg] : edges_to_remove) {
-    for (const gene_id tar : remove_from_reg)
-      network[reg].erase(tar);
-    size_of_network -= remove_from_reg.size();
-  }
-
-  return std::make_pair(network, size_of_network);
+  stats.num_reg_pairs = num_reg_pairs;
+  stats.num_triangles = num_triangles;
+  stats.enumerate_secs = omp_get_wtime() - step_start;
+  step_start = omp_get_wtime();
+
+  // each word is merged by one thread, from the bitmaps of the threads that ran
+  std::vector<uint64_t> &removed = thread_removed[0];
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (uint32_t w = 0U; w < num_words; ++w)
+    for (uint16_t th = 1U; th < team_size; ++th)
+      removed[w] |= thread_removed[th][w];
+  stats.merge_secs = omp_get_wtime() - step_start;
+  step_start = omp_get_wtime();
+
+  CSRNetwork pruned_net = network.withoutEdges(removed);
+  stats.rebuild_secs = omp_get_wtime() - step_start;
+  return pruned_net;
 }
 
+// Regulators per tile of the raw MI matrix
+static constexpr uint32_t MI_TILE_REGS = 16U;
+// Target ranks per tile of the raw MI matrix, sized to sit in L2
+static constexpr uint32_t MI_TILE_BYTES = 256U * 1024U;
+
 /*
- Generates an ARACNe3 subnet (called from main).
+ Generates an ARACNe3 subnet (called from main).  The subnet log is written
+ here; the subnet file is left to the caller (see writeSubnetFile).
 */
-std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
-    const gene_to_floats &subsample_exp_mat, const geneset &regulators,
+std::pair<CSRNetwork, float> createARACNe3Subnet(
+    const gene_to_shorts &subsample_ranks_mat, const geneset &regulators,
     const geneset &genes, const uint16_t tot_num_samps,
     const uint16_t tot_num_subsample, const uint16_t cur_subnet_ct,
     const bool prune_alpha, const APMINullModel &nullmodel,
-    const std::string &method, const float alpha, const bool prune_MaxEnt,
-    const std::string &output_dir, const std::string &subnets_dir,
-    const std::string &subnets_log_dir, const uint16_t nthreads,
-    const std::string &runid) {
+    const std::string &method, const float alpha, const float mi_cutoff,
+    const bool prune_MaxEnt, const std::string &output_dir,
+    const std::string &subnets_dir, const std::string &subnets_log_dir,
+    const uint16_t nthreads, const std::string &runid) {
 
   float FPR_estimate_subnet;
   std::ofstream log_output(subnets_log_dir + "log_subnet" +
@@ -185,6 +253,8 @@ std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
                            ".txt");
   std::time_t t = std::time(nullptr);
 
+  // std::localtime shares one buffer, and subnets may be generated concurrently
+#pragma omp critical(localtime)
   log_output << "---------" << std::put_time(std::localtime(&t), "%c %Z")
              << "---------" << std::endl
              << std::endl;
@@ -203,6 +273,8 @@ std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
              << std::endl;
   log_output << "Method of first pruning step: " + method << std::endl;
   log_output << "Alpha: " + std::to_string(alpha) << std::endl;
+  if (mi_cutoff > 0.0f)
+    log_output << "MI cutoff: " + std::to_string(mi_cutoff) << std::endl;
   log_output << "MaxEnt Pruning: " +
                     std::string(prune_MaxEnt ? "true" : "false")
              << std::endl;
@@ -217,44 +289,153 @@ std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
   watch1.reset();
   //-------------------------
 
-  uint32_t size_of_subnetwork = 0U;
+  // every regulator-target pair is a test, whatever its MI
+  uint32_t size_of_subnetwork = regulators.size() * (genes.size() - 1U);
 
   // vectorize sets and network for parallelism
   const std::vector<gene_id> regs_vec(regulators.begin(), regulators.end()),
       genes_vec(genes.begin(), genes.end());
 
-  std::vector<std::vector<float>> subnetwork_vec(
-      regulators.size(), std::vector<float>(genes.size(), 0.f));
-
-#pragma omp parallel for num_threads(nthreads)
-  for (int reg_idx = 0; reg_idx < regulators.size(); ++reg_idx) {
-    const gene_id reg = regs_vec[reg_idx];
-    for (int tar_idx = 0; tar_idx < genes.size(); ++tar_idx) {
-      const gene_id tar = genes_vec[tar_idx];
-      if (reg != tar)
-        subnetwork_vec[reg_idx][tar_idx] =
-            calcAPMI(subsample_exp_mat.at(reg), subsample_exp_mat.at(tar));
-    }
-  }
+  /*
+   Edges weaker than the MI floor cannot survive threshold pruning, so the
+   dense regulator x gene matrix is never stored: each thread keeps only the
+   edges at or above the floor (and the MI cutoff) in its own buffer.
+   */
+  const float mi_floor = std::max(
+      nullmodel.getMIFloor(pruneAlphaPCutoff(method, alpha, size_of_subnetwork)),
+      mi_cutoff);
+  std::vector<std::vector<network_edge>> thread_edges(nthreads);
+
+  // positions in regs_vec by gene id (-1 if not a regulator)
+  std::vector<int32_t> reg_idx_of(subsample_ranks_mat.size(), -1);
+  for (uint32_t reg_idx = 0U; reg_idx < regs_vec.size(); ++reg_idx)
+    reg_idx_of[regs_vec[reg_idx]] = reg_idx;
+  // a target after regulator reg_idx in regs_vec shares both of its edges
+  const auto isLaterRegulator = [&reg_idx_of](const gene_id tar,
+                                              const uint32_t reg_idx) {
+    return reg_idx_of[tar] >= 0 &&
+           static_cast<uint32_t>(reg_idx_of[tar]) > reg_idx;
+  };
+
+  // each regulator's rank order, shared by all of its target tiles
+  std::vector<apmi_regulator_order> reg_orders(regs_vec.size());
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (uint32_t reg_idx = 0U; reg_idx < regs_vec.size(); ++reg_idx)
+    reg_orders[reg_idx] =
+        apmi_regulator_order(subsample_ranks_mat[regs_vec[reg_idx]]);
+
+  uint64_t num_computed = 0U, num_screened = 0U;
+  uint32_t num_below_cutoff = 0U;
+
+  /*
+   The regulator x target matrix is cut into tiles of MI_TILE_REGS regulators by
+   as many targets as fit in MI_TILE_BYTES of ranks, so a tile's targets stay in
+   cache while each of its regulators streams over them.  Tessellation cost
+   varies widely between pairs, so tiles are handed out dynamically.
+
+   APMI is symmetric, so the lower-indexed regulator of each reg-reg pair
+   computes it and emits both edges.
+   */
+  const uint32_t num_reg_tiles =
+      (regulators.size() + MI_TILE_REGS - 1U) / MI_TILE_REGS;
+  // smaller target tiles if needed to give every thread several tiles
+  const uint32_t min_tar_tiles =
+      (8U * nthreads + num_reg_tiles - 1U) / std::max(num_reg_tiles, 1U);
+  const uint32_t tile_tars = std::max<uint32_t>(
+      32U, std::min<uint32_t>(
+               MI_TILE_BYTES / (tot_num_subsample * sizeof(uint16_t)),
+               (genes.size() + min_tar_tiles - 1U) / min_tar_tiles));
+  const uint32_t num_tar_tiles = (genes.size() + tile_tars - 1U) / tile_tars;
+  std::vector<double> busy_secs(nthreads, 0.0);
+  const double region_start = omp_get_wtime();
+
+#pragma omp parallel num_threads(nthreads)                                     \
+    reduction(+ : num_computed, num_screened, num_below_cutoff)
+  {
+    double &busy = busy_secs[omp_get_thread_num()];
+    auto &edges = thread_edges[omp_get_thread_num()];
+    std::vector<gene_id> tars;
+    tars.reserve(tile_tars);
+
+#pragma omp for schedule(dynamic) nowait
+    for (uint32_t tile = 0U; tile < num_reg_tiles * num_tar_tiles; ++tile) {
+      const double tile_start = omp_get_wtime();
+      const uint32_t reg_begin = (tile / num_tar_tiles) * MI_TILE_REGS,
+                     reg_end = std::min<uint32_t>(reg_begin + MI_TILE_REGS,
+                                                  regulators.size()),
+                     tar_begin = (tile % num_tar_tiles) * tile_tars,
+                     tar_end =
+                         std::min<uint32_t>(tar_begin + tile_tars, genes.size());
+
+      for (uint32_t reg_idx = reg_begin; reg_idx < reg_end; ++reg_idx) {
+        const gene_id reg = regs_vec[reg_idx];
+
+        // the tile's non-regulators, and its regulators after this one
+        tars.clear();
+        for (uint32_t tar_idx = tar_begin; tar_idx < tar_end; ++tar_idx) {
+          const gene_id tar = genes_vec[tar_idx];
+          if (reg_idx_of[tar] < 0 || isLaterRegulator(tar, reg_idx))
+            tars.push_back(tar);
+        }
 
-  // transfer back to hash map structure
-  gene_to_gene_to_float subnetwork;
-  subnetwork.reserve(regulators.size());
-  for (uint16_t reg_idx = 0U; reg_idx < regulators.size(); ++reg_idx) {
-    const gene_id reg = regs_vec[reg_idx];
-    for (uint16_t tar_idx = 0U; tar_idx < genes.size(); ++tar_idx) {
-      const gene_id tar = genes_vec[tar_idx];
-      if (reg != tar) {
-        subnetwork[reg][tar] = subnetwork_vec[reg_idx][tar_idx];
-        ++size_of_subnetwork;
+        uint32_t reg_screened = 0U;
+        const std::vector<float> mis = calcAPMIRegulatorVsMany(
+            reg_orders[reg_idx], subsample_ranks_mat, tars,
+            apmi_default_policy(), &reg_screened);
+        num_computed += tars.size();
+        num_screened += reg_screened;
+        for (size_t t = 0U; t < tars.size(); ++t) {
+          // pairs below the MI cutoff still count toward the number of tests
+          const uint8_t num_edges = isLaterRegulator(tars[t], reg_idx) ? 2U : 1U;
+          if (mi_cutoff > 0.0f && mis[t] < mi_cutoff)
+            num_below_cutoff += num_edges;
+          if (mis[t] >= mi_floor) {
+            edges.emplace_back(reg, tars[t], mis[t]);
+            if (num_edges == 2U)
+              edges.emplace_back(tars[t], reg, mis[t]);
+          }
+        }
       }
+      busy += omp_get_wtime() - tile_start;
     }
   }
+  const double region_secs = omp_get_wtime() - region_start;
+
+  // merge the threads' edges for threshold pruning
+  std::vector<network_edge> reg_tar_mi;
+  size_t num_streamed = 0U;
+  for (const auto &edges : thread_edges)
+    num_streamed += edges.size();
+  reg_tar_mi.reserve(num_streamed);
+  for (auto &edges : thread_edges) {
+    reg_tar_mi.insert(reg_tar_mi.end(), edges.begin(), edges.end());
+    std::vector<network_edge>().swap(edges);
+  }
 
   //-------time module-------
   log_output << watch1.getSeconds() << std::endl;
   log_output << "Size of subnetwork: " << size_of_subnetwork << " edges."
              << std::endl;
+  log_output << "MI tiles: " << num_reg_tiles * num_tar_tiles << " of "
+             << MI_TILE_REGS << " regulators x " << tile_tars << " targets."
+             << std::endl;
+  for (uint16_t th = 0U; th < nthreads; ++th)
+    log_output << "Thread " << th << " busy/idle: "
+               << std::to_string(busy_secs[th]) << "s / "
+               << std::to_string(region_secs - busy_secs[th]) << "s"
+               << std::endl;
+  log_output << "APMI computations (reg-reg pairs computed once): "
+             << num_computed << "." << std::endl;
+  log_output << "Pairs resolved by the APMI screening histogram: "
+             << num_screened << " ("
+             << std::to_string(100.0 * num_screened /
+                               std::max<uint64_t>(num_computed, 1U))
+             << "%)." << std::endl;
+  if (mi_cutoff > 0.0f)
+    log_output << "Pairs below MI cutoff: " << num_below_cutoff << "."
+               << std::endl;
+  log_output << "Edges kept at or above MI floor " << std::to_string(mi_floor)
+             << ": " << num_streamed << "." << std::endl;
   //-------------------------
 
   //-------time module-------
@@ -265,15 +446,24 @@ std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
 
   uint32_t size_prev = size_of_subnetwork;
 
-  // unpack tuple into objects
-  gene_to_gene_to_float subnetwork_reg_reg_only;
-
-  std::tie(subnetwork, size_of_subnetwork, subnetwork_reg_reg_only) =
-      pruneAlpha(subnetwork, regulators, size_of_subnetwork, method, alpha,
-                 nullmodel);
+  prune_alpha_stats prune_stats;
+  CSRNetwork subnetwork =
+      pruneAlpha(std::move(reg_tar_mi), subsample_ranks_mat.size(),
+                 size_of_subnetwork, method, alpha, nullmodel, nthreads,
+                 prune_stats);
+  size_of_subnetwork = subnetwork.size();
 
   //-------time module-------
   log_output << watch1.getSeconds() << std::endl;
+  log_output << (method == "FDR" ? "Candidate edges sorted: "
+                                  : "Candidate edges: ")
+             << prune_stats.num_candidates << " of " << size_prev << "."
+             << std::endl;
+  log_output << "Filter/sort/cutoff/rebuild time: "
+             << std::to_string(prune_stats.filter_secs) << "s / "
+             << std::to_string(prune_stats.sort_secs) << "s / "
+             << std::to_string(prune_stats.cutoff_secs) << "s / "
+             << std::to_string(prune_stats.rebuild_secs) << "s" << std::endl;
   log_output << "Edges removed: " << size_prev - size_of_subnetwork << " edges."
              << std::endl;
   log_output << "Size of subnetwork: " << size_of_subnetwork << " edges."
@@ -291,11 +481,19 @@ std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
     //-------------------------
 
     size_prev = size_of_subnetwork;
-    std::tie(subnetwork, size_of_subnetwork) = pruneMaxEnt(
-        subnetwork, size_of_subnetwork, regulators, subnetwork_reg_reg_only, nthreads);
+    prune_MaxEnt_stats MaxEnt_stats;
+    subnetwork = pruneMaxEnt(subnetwork, regulators, nthreads, MaxEnt_stats);
+    size_of_subnetwork = subnetwork.size();
 
     //-------time module-------
     log_output << watch1.getSeconds() << std::endl;
+    log_output << "Regulator pairs: " << MaxEnt_stats.num_reg_pairs
+               << ", triangles: " << MaxEnt_stats.num_triangles << "."
+               << std::endl;
+    log_output << "Enumerate/merge/rebuild time: "
+               << std::to_string(MaxEnt_stats.enumerate_secs) << "s / "
+               << std::to_string(MaxEnt_stats.merge_secs) << "s / "
+               << std::to_string(MaxEnt_stats.rebuild_secs) << "s" << std::endl;
     log_output << "Edges removed: " << size_prev - size_of_subnetwork
                << " edges." << std::endl;
     log_output << "Size of subnetwork: " << size_of_subnetwork << " edges."
@@ -325,20 +523,10 @@ std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
       FPR_estimate_subnet = alpha;
   }
 
-  //-------time module-------
-  log_output << "\nPrinting subnetwork in directory \"" + subnets_dir + "\"...";
-  log_output.flush();
-  watch1.reset();
-  //-------------------------
-
-  // writes the individual subnet output
-  writeNetworkRegTarMI(subnetwork, subnets_dir + "subnet" +
-                                       std::to_string(cur_subnet_ct + 1) + "_" +
-                                       runid + ".tsv");
-
-  //-------time module-------
-  log_output << watch1.getSeconds() << std::endl;
-  //-------------------------
+  // main writes the individual subnet output, off the critical path
+  log_output << "\nSubnetwork to be written in directory \"" + subnets_dir +
+                    "\"."
+             << std::endl;
 
   std::cout << "...subnetwork " + std::to_string(cur_subnet_ct + 1) +
                    " completed = " + std::to_string(size_of_subnetwork) +
@@ -348,32 +536,61 @@ std::pair<gene_to_gene_to_float, float> createARACNe3Subnet(
   return std::make_pair(subnetwork, FPR_estimate_subnet);
 }
 
+/*
+ Consolidates the subnets folded into the accumulator, in parallel over
+ regulators.  Only edges found in at least one subnet are visited, and each
+ regulator's edges are output in target id order.  Regulators are output in
+ the order of regulators, so the result does not depend on the number of
+ threads.  The binomial tail takes one value per occurrence count, so it is
+ computed once per count.
+ */
 const std::vector<consolidated_df_row>
-consolidateSubnetsVec(const std::vector<gene_to_gene_to_float> &subnets,
-                      const float FPR_estimate, const gene_to_floats &exp_mat,
+consolidateSubnetsVec(const SubnetAccumulator &accumulated,
                       const geneset &regulators, const geneset &genes,
-                      const gene_to_shorts &ranks_mat) {
-  std::vector<consolidated_df_row> final_df;
-  const uint32_t tot_poss_edgs = regulators.size() * (genes.size() - 1);
-
-  for (const gene_id reg : regulators) {
-    for (const gene_id tar : genes) {
-      uint16_t num_occurrences = 0U;
-      for (uint16_t sn = 0U; sn < subnets.size(); ++sn) {
-        if (subnets[sn].find(reg) != subnets[sn].end())
-          if (subnets[sn].at(reg).find(tar) != subnets[sn].at(reg).end())
-            ++num_occurrences;
-      }
-      if (num_occurrences > 0) {
-        const float final_mi = calcAPMI(exp_mat.at(reg), exp_mat.at(tar));
-        const float final_scc = calcSCC(ranks_mat.at(reg), ranks_mat.at(tar));
-        const double final_log_p =
-            lRightTailBinomialP(subnets.size(), num_occurrences, FPR_estimate);
-        final_df.emplace_back(reg, tar, final_mi, final_scc, num_occurrences,
-                              final_log_p);
-      }
+                      const gene_to_shorts &ranks_mat,
+                      const uint16_t nthreads) {
+  const std::vector<gene_id> regs_vec(regulators.begin(), regulators.end());
+  std::vector<bool> is_gene(ranks_mat.size(), false);
+  for (const gene_id gene : genes)
+    if (gene < ranks_mat.size())
+      is_gene[gene] = true;
+
+  const uint16_t num_subnets = accumulated.numSubnets();
+  const float FPR_estimate = accumulated.FPREstimate();
+  std::vector<double> final_log_p(num_subnets + 1U);
+  for (uint16_t k = 0U; k <= num_subnets; ++k)
+    final_log_p[k] = lRightTailBinomialP(num_subnets, k, FPR_estimate);
+
+  std::vector<std::vector<consolidated_df_row>> reg_df(regs_vec.size());
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+  for (size_t i = 0U; i < regs_vec.size(); ++i) {
+    const gene_id reg = regs_vec[i];
+    if (reg >= ranks_mat.size())
+      continue;
+    const std::vector<gene_id> &tars = accumulated.rowTargets(reg);
+    const std::vector<uint16_t> &num_occurrences = accumulated.rowCounts(reg);
+
+    reg_df[i].reserve(tars.size());
+    for (size_t j = 0U; j < tars.size(); ++j) {
+      const gene_id tar = tars[j];
+      if (tar >= ranks_mat.size() || !is_gene[tar])
+        continue;
+      const float final_mi = calcAPMI(ranks_mat[reg], ranks_mat[tar]);
+      const float final_scc = calcSCC(ranks_mat[reg], ranks_mat[tar]);
+      reg_df[i].emplace_back(reg, tar, final_mi, final_scc, num_occurrences[j],
+                             final_log_p[num_occurrences[j]]);
     }
   }
 
+  std::vector<consolidated_df_row> final_df;
+  size_t num_edges = 0U;
+  for (const auto &df : reg_df)
+    num_edges += df.size();
+  final_df.reserve(num_edges);
+  for (const auto &df : reg_df)
+    for (const consolidated_df_row &row : df)
+      final_df.push_back(row);
+
   return final_df;
 }
@@ -1,5 +1,26 @@
 #include <gtest/gtest.h>
 #include "algorithms.hpp"
+#include "apmi_nullmodel.hpp"
+#include "csr_network.hpp"
+#include "io.hpp"
+#include "philox.hpp"
+#include "simd_kernels.hpp"
+#include "subnet_accumulator.hpp"
+#include "subnet_operations.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <numeric>
+#include <omp.h>
+#include <set>
+
+// defined by ARACNe3.cpp in the app
+uint16_t nthreads = 1U;
 
 TEST(AlgorithmsTest, RankIndicesTest) {
   // Test the rankIndices function
@@ -72,3 +93,494 @@ TEST(AlgorithmsTest, LogRightTailBinomialPKnownValues) {
     EXPECT_NEAR(-200, lRightTailBinomialP(200, 200, 1./std::exp(1)), 1e-5);
     EXPECT_NEAR(-65534, lRightTailBinomialP(65534U, 65534U, 1./std::exp(1)), 1e-5);
 }
+
+// calcAPMI on ranks must agree bit-for-bit with calcAPMI on copula values
+TEST(AlgorithmsTest, CalcAPMIRanksMatchCopula) {
+  std::mt19937 rand(1);
+  for (const uint16_t n : {5, 50, 159, 600, 1999}) {
+    std::vector<uint16_t> x_ranks(n), y_ranks(n);
+    std::iota(x_ranks.begin(), x_ranks.end(), 1U);
+    std::iota(y_ranks.begin(), y_ranks.end(), 1U);
+    for (int trial = 0; trial < 20; ++trial) {
+      // alternate between independent and strongly dependent pairs
+      std::shuffle(y_ranks.begin(), y_ranks.end(), rand);
+      if (trial % 2)
+        std::sort(y_ranks.begin(), y_ranks.begin() + n * 9 / 10);
+      std::vector<float> x_vec(n), y_vec(n);
+      for (uint16_t i = 0; i < n; ++i) {
+        x_vec[i] = x_ranks[i] / ((float)n + 1);
+        y_vec[i] = y_ranks[i] / ((float)n + 1);
+      }
+      EXPECT_EQ(calcAPMI(x_vec, y_vec), calcAPMI(x_ranks, y_ranks));
+    }
+  }
+}
+
+// batched regulator APMI must agree bit-for-bit with pairwise calcAPMI
+TEST(AlgorithmsTest, CalcAPMIRegulatorVsManyMatchesPairwise) {
+  std::mt19937 rand(2);
+  for (const uint16_t n : {5, 159, 600}) {
+    gene_to_shorts ranks_mat(30, std::vector<uint16_t>(n));
+    for (auto &ranks : ranks_mat) {
+      std::iota(ranks.begin(), ranks.end(), 1U);
+      std::shuffle(ranks.begin(), ranks.end(), rand);
+    }
+    // make some targets depend on the regulator
+    for (uint16_t g = 1U; g < 10U; ++g)
+      for (uint16_t i = 0U; i < n; ++i)
+        if (i % g == 0U)
+          std::swap(ranks_mat[g][i],
+                    ranks_mat[g][std::find(ranks_mat[g].begin(),
+                                           ranks_mat[g].end(),
+                                           ranks_mat[0][i]) -
+                                 ranks_mat[g].begin()]);
+
+    std::vector<gene_id> targets(ranks_mat.size() - 1U);
+    std::iota(targets.begin(), targets.end(), 1U);
+    uint32_t num_screened = 0U;
+    const std::vector<float> mis = calcAPMIRegulatorVsMany(
+        ranks_mat[0], ranks_mat, targets, 7.815, 4, &num_screened);
+    for (size_t t = 0U; t < targets.size(); ++t)
+      EXPECT_EQ(calcAPMI(ranks_mat[0], ranks_mat[targets[t]]), mis[t]);
+
+    // both the screening histogram and the full kernel are exercised
+    if (n > 5U) {
+      EXPECT_GT(num_screened, 0U);
+      EXPECT_LT(num_screened, targets.size());
+    }
+  }
+}
+
+// every split kernel the CPU supports must give the scalar kernel's output
+TEST(AlgorithmsTest, SplitByYKernelsMatchScalar) {
+  std::mt19937 rand(3);
+  const std::string best = splitKernelName();
+  for (const uint16_t n : {1, 15, 16, 17, 100, 1000}) {
+    std::vector<uint16_t> pts(n), ys(n);
+    std::iota(pts.begin(), pts.end(), 0U);
+    std::iota(ys.begin(), ys.end(), 1U);
+    std::shuffle(ys.begin(), ys.end(), rand);
+    for (const uint32_t thresh : {0U, 1U, n / 2U + 1U, n + 1U, 65535U, 65536U}) {
+      ASSERT_TRUE(useSplitKernel("scalar"));
+      std::vector<uint16_t> sb_pts(n), sb_ys(n), st_pts(n), st_ys(n);
+      const uint16_t sb = splitByY(pts.data(), ys.data(), n, thresh,
+                                   sb_pts.data(), sb_ys.data(), st_pts.data(),
+                                   st_ys.data());
+      for (const std::string &kernel : availableSplitKernels()) {
+        ASSERT_TRUE(useSplitKernel(kernel));
+        // in place on the bottom half, as calcAPMI uses it
+        std::vector<uint16_t> b_pts = pts, b_ys = ys, t_pts(n), t_ys(n);
+        const uint16_t b =
+            splitByY(b_pts.data(), b_ys.data(), n, thresh, b_pts.data(),
+                     b_ys.data(), t_pts.data(), t_ys.data());
+        ASSERT_EQ(sb, b) << kernel;
+        for (uint16_t i = 0U; i < b; ++i)
+          ASSERT_TRUE(b_pts[i] == sb_pts[i] && b_ys[i] == sb_ys[i]) << kernel;
+        for (uint16_t i = 0U; i < n - b; ++i)
+          ASSERT_TRUE(t_pts[i] == st_pts[i] && t_ys[i] == st_ys[i]) << kernel;
+      }
+    }
+  }
+  ASSERT_TRUE(useSplitKernel(best));
+}
+
+// the Morton quadtree engine must agree bit-for-bit with calcAPMI
+TEST(AlgorithmsTest, CalcAPMIMortonMatchesCalcAPMI) {
+  std::mt19937 rand(4);
+  for (const uint16_t n : {3, 5, 64, 127, 159, 600, 4095}) {
+    std::vector<uint16_t> x_ranks(n), y_ranks(n);
+    std::iota(x_ranks.begin(), x_ranks.end(), 1U);
+    std::iota(y_ranks.begin(), y_ranks.end(), 1U);
+    for (int trial = 0; trial < 10; ++trial) {
+      std::shuffle(y_ranks.begin(), y_ranks.end(), rand);
+      if (trial % 2)
+        std::sort(y_ranks.begin(), y_ranks.begin() + n * 3 / 4);
+      EXPECT_EQ(calcAPMI(x_ranks, y_ranks), calcAPMIMorton(x_ranks, y_ranks));
+      EXPECT_EQ(calcAPMI(x_ranks, y_ranks, 1.f, 2U),
+                calcAPMIMorton(x_ranks, y_ranks, 1.f, 2U));
+    }
+  }
+}
+
+// APMI is exactly symmetric, which lets subnets compute reg-reg pairs once
+TEST(AlgorithmsTest, CalcAPMISymmetric) {
+  std::mt19937 rand(5);
+  for (const uint16_t n : {5, 159, 600, 10000}) {
+    std::vector<uint16_t> x_ranks(n), y_ranks(n);
+    std::iota(x_ranks.begin(), x_ranks.end(), 1U);
+    std::iota(y_ranks.begin(), y_ranks.end(), 1U);
+    for (int trial = 0; trial < 200; ++trial) {
+      std::shuffle(x_ranks.begin(), x_ranks.end(), rand);
+      std::shuffle(y_ranks.begin(), y_ranks.end(), rand);
+      if (trial % 2)
+        std::sort(y_ranks.begin(), y_ranks.begin() + n / 2);
+      EXPECT_EQ(calcAPMI(x_ranks, y_ranks), calcAPMI(y_ranks, x_ranks));
+    }
+  }
+}
+
+// the compile-time and runtime policies run the same estimator
+TEST(AlgorithmsTest, APMIPoliciesMatchThresholds) {
+  std::mt19937 rand(6);
+  const uint16_t n = 300;
+  gene_to_shorts ranks_mat(8, std::vector<uint16_t>(n));
+  for (auto &ranks : ranks_mat) {
+    std::iota(ranks.begin(), ranks.end(), 1U);
+    std::shuffle(ranks.begin(), ranks.end(), rand);
+  }
+  std::sort(ranks_mat[1].begin(), ranks_mat[1].begin() + n / 2);
+  const std::vector<gene_id> targets = {1, 2, 3, 4, 5, 6, 7};
+
+  const apmi_runtime_policy loose{1.0f, 2U};
+  EXPECT_EQ(calcAPMIRegulatorVsMany(ranks_mat[0], ranks_mat, targets),
+            calcAPMIRegulatorVsMany(ranks_mat[0], ranks_mat, targets,
+                                    apmi_default_policy()));
+  EXPECT_EQ(calcAPMIRegulatorVsMany(ranks_mat[0], ranks_mat, targets, 1.0f, 2U),
+            calcAPMIRegulatorVsMany(ranks_mat[0], ranks_mat, targets, loose));
+  for (const gene_id t : targets) {
+    EXPECT_EQ(calcAPMI(ranks_mat[0], ranks_mat[t]),
+              calcAPMI(ranks_mat[0], ranks_mat[t], apmi_default_policy()));
+    EXPECT_EQ(calcAPMI(ranks_mat[0], ranks_mat[t], 1.0f, 2U),
+              calcAPMI(ranks_mat[0], ranks_mat[t], loose));
+    EXPECT_EQ(
+        calcAPMI(ranks_mat[0], ranks_mat[t], apmi_runtime_policy{7.815f, 4U}),
+        calcAPMI(ranks_mat[0], ranks_mat[t], apmi_default_policy()));
+  }
+}
+
+// Philox4x32-10 known-answer test (Random123 kat_vectors), key 0, counter 0
+TEST(AlgorithmsTest, Philox4x32KnownAnswer) {
+  Philox4x32 stream(0U, 0U);
+  EXPECT_EQ(stream(), 0x6627e8d5U);
+  EXPECT_EQ(stream(), 0xe169c58dU);
+  EXPECT_EQ(stream(), 0xbc57ac4cU);
+  EXPECT_EQ(stream(), 0x9b00dbd8U);
+}
+
+// getMIPVal(mi) < p exactly when mi >= getMIThreshold(p)
+TEST(AlgorithmsTest, NullModelMIThresholdInvertsPVal) {
+  std::mt19937 rand{1};
+  const APMINullModel nullmodel(20000U, 60U, "./no_cache_dir/", rand);
+
+  std::vector<float> mis;
+  for (float mi = 0.0f; mi < 0.5f; mi += 0.0001f) {
+    mis.push_back(mi);
+    mis.push_back(std::nextafter(mi, 0.0f));
+  }
+  for (const float p : {0.5f, 0.05f, 0.01f, 0.0015f, 0.0005f, 1e-6f, 1e-12f}) {
+    const float thresh = nullmodel.getMIThreshold(p);
+    if (std::isnan(thresh))
+      continue;
+    for (const float mi : mis)
+      EXPECT_EQ(nullmodel.getMIPVal(mi) < p, mi >= thresh)
+          << "p = " << p << ", mi = " << mi;
+  }
+}
+
+// an empty scratch directory for null model caches, with a trailing slash
+static std::string freshCacheDir(const std::string &name) {
+  const std::filesystem::path dir =
+      std::filesystem::temp_directory_path() / ("ARACNe3_test_" + name);
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  return dir.string() + "/";
+}
+
+static std::vector<char> readBytes(const std::string &filename) {
+  std::ifstream ifs(filename, std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(ifs), {});
+}
+
+static void writeBytes(const std::string &filename,
+                       const std::vector<char> &bytes) {
+  std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+  ofs.write(bytes.data(), bytes.size());
+}
+
+// true if the two models give every MI on a fine grid the same p-value
+static bool samePVals(const APMINullModel &a, const APMINullModel &b) {
+  for (float mi = 0.0f; mi < 0.5f; mi += 0.0005f)
+    if (a.getMIPVal(mi) != b.getMIPVal(mi))
+      return false;
+  return true;
+}
+
+// a cached model maps back with the same nulls, whatever rand would draw
+TEST(AlgorithmsTest, NullModelCacheRoundTrip) {
+  const std::string dir = freshCacheDir("round_trip");
+  std::mt19937 rand1{1}, rand2{2}, rand3{2};
+  APMINullModel built(20000U, 60U, dir, rand1);
+  built.cacheNullModel(dir);
+  ASSERT_TRUE(std::filesystem::exists(dir + "Nssamp-60_Nnull-20000.bin"));
+
+  const APMINullModel loaded(20000U, 60U, dir, rand2);
+  EXPECT_TRUE(samePVals(built, loaded));
+  EXPECT_EQ(built.getDiagnostics(), loaded.getDiagnostics());
+
+  // a model computed from rand2's draw differs, so the nulls came from the file
+  const APMINullModel other(20000U, 60U, freshCacheDir("round_trip_other"),
+                            rand3);
+  EXPECT_FALSE(samePVals(built, other));
+}
+
+// a cache with a bad checksum or header is ignored, recomputed and rewritten
+TEST(AlgorithmsTest, NullModelCacheRejectsCorruptFiles) {
+  const std::string dir = freshCacheDir("corrupt"),
+                    filename = dir + "Nssamp-60_Nnull-20000.bin";
+  std::mt19937 rand1{1};
+  APMINullModel(20000U, 60U, dir, rand1).cacheNullModel(dir);
+  const std::vector<char> original = readBytes(filename);
+
+  std::mt19937 rand2{2};
+  const APMINullModel expected(20000U, 60U, freshCacheDir("corrupt_fresh"),
+                               rand2);
+
+  std::vector<char> bad_checksum = original, bad_version = original;
+  bad_checksum[sizeof(null_cache_header) + 5U] ^= 1;
+  ++bad_version[offsetof(null_cache_header, version)];
+  for (const auto &corrupted : {bad_checksum, bad_version}) {
+    writeBytes(filename, corrupted);
+    std::mt19937 rand3{2}, rand4{3};
+    APMINullModel rebuilt(20000U, 60U, dir, rand3);
+    EXPECT_TRUE(samePVals(rebuilt, expected));
+
+    rebuilt.cacheNullModel(dir);
+    const APMINullModel reloaded(20000U, 60U, dir, rand4);
+    EXPECT_TRUE(samePVals(reloaded, expected));
+  }
+}
+
+// an adaptive model stops early, but its nulls are those of the full model
+TEST(AlgorithmsTest, AdaptiveNullModelIsPrefixOfFullModel) {
+  const std::string dir = freshCacheDir("adaptive");
+  std::mt19937 rand1{1};
+  APMINullModel(200000U, 60U, dir, rand1, true, 0.05f).cacheNullModel(dir);
+  const std::vector<char> adaptive = readBytes(
+      dir + "Nssamp-60_Nnull-200000_adaptive-" + std::to_string(0.05f) +
+      ".bin");
+  ASSERT_GT(adaptive.size(), sizeof(null_cache_header));
+  null_cache_header header;
+  std::copy_n(adaptive.data(), sizeof(header),
+              reinterpret_cast<char *>(&header));
+  ASSERT_GT(header.n_nulls, 0U);
+
+  std::mt19937 rand2{1};
+  APMINullModel(header.n_nulls, 60U, dir, rand2).cacheNullModel(dir);
+  const std::vector<char> full = readBytes(
+      dir + "Nssamp-60_Nnull-" + std::to_string(header.n_nulls) + ".bin");
+  ASSERT_EQ(full.size(), adaptive.size());
+  EXPECT_TRUE(std::equal(adaptive.begin() + sizeof(header), adaptive.end(),
+                         full.begin() + sizeof(header)));
+}
+
+// a model interpolated from the library is within its reported error
+TEST(AlgorithmsTest, InterpolatedNullModelWithinReportedError) {
+  const std::string dir = freshCacheDir("library");
+  for (const uint16_t n : {40U, 80U}) {
+    std::mt19937 rand{1};
+    APMINullModel(20000U, n, dir, rand).cacheNullModel(dir);
+  }
+  std::mt19937 rand1{1}, rand2{1};
+  const APMINullModel interpolated(20000U, 60U, dir, rand1, false, 0.05f,
+                                   true);
+  const APMINullModel computed(20000U, 60U, freshCacheDir("library_direct"),
+                               rand2);
+
+  const std::string diagnostics = interpolated.getDiagnostics(),
+                    marker = "error <= ";
+  ASSERT_NE(diagnostics.find("N = 40"), std::string::npos);
+  ASSERT_NE(diagnostics.find(marker), std::string::npos);
+  const float error =
+      std::stof(diagnostics.substr(diagnostics.find(marker) + marker.size()));
+  EXPECT_GT(error, 0.0f);
+
+  for (const float p : {0.5f, 0.2f, 0.1f, 0.05f, 0.01f, 0.002f})
+    EXPECT_NEAR(interpolated.getMIFloor(p), computed.getMIFloor(p), error)
+        << "p = " << p;
+}
+
+TEST(AlgorithmsTest, CSRNetworkRowsSortedAndEdgesRemoved) {
+  const std::vector<network_edge> edges = {
+      {2, 7, 0.5f}, {0, 3, 0.1f}, {2, 1, 0.2f}, {0, 1, 0.3f}, {2, 4, 0.4f}};
+  const CSRNetwork network(edges, 8U);
+
+  EXPECT_EQ(network.size(), 5U);
+  EXPECT_EQ(network.rowEnd(1) - network.rowBegin(1), 0U);
+  EXPECT_EQ(network.rowEnd(9) - network.rowBegin(9), 0U);
+  const std::vector<gene_id> row2 = {1, 4, 7};
+  for (uint32_t i = 0U; i < row2.size(); ++i)
+    EXPECT_EQ(network.target(network.rowBegin(2) + i), row2[i]);
+  EXPECT_EQ(network.mi(network.find(2, 4)), 0.4f);
+  EXPECT_EQ(network.find(2, 3), network.size());
+
+  std::vector<uint64_t> removed(1U, 0U);
+  removed[0] |= uint64_t{1} << network.find(2, 4);
+  const CSRNetwork pruned = network.withoutEdges(removed);
+  EXPECT_EQ(pruned.size(), 4U);
+  EXPECT_EQ(pruned.find(2, 4), pruned.size());
+  EXPECT_EQ(pruned.mi(pruned.find(2, 7)), 0.5f);
+  EXPECT_EQ(pruned.mi(pruned.find(0, 1)), 0.3f);
+}
+
+static std::set<std::pair<gene_id, gene_id>>
+edgeSet(const CSRNetwork &network) {
+  std::set<std::pair<gene_id, gene_id>> edges;
+  for (gene_id reg = 0U; reg < network.numRows(); ++reg)
+    for (uint32_t e = network.rowBegin(reg); e < network.rowEnd(reg); ++e)
+      edges.emplace(reg, network.target(e));
+  return edges;
+}
+
+// pruneAlpha keeps the edges that sorting every edge and cutting it keeps
+TEST(AlgorithmsTest, PruneAlphaMatchesSortingEveryEdge) {
+  std::mt19937 rand{3};
+  const APMINullModel nullmodel(20000U, 60U, "./no_cache_dir/", rand);
+  std::uniform_real_distribution<float> unif(0.0f, 0.8f);
+  const gene_id num_regs = 10U, num_genes = 200U;
+  std::vector<network_edge> edges;
+  for (gene_id reg = 0U; reg < num_regs; ++reg)
+    for (gene_id tar = 0U; tar < num_genes; ++tar)
+      if (tar != reg)
+        edges.emplace_back(reg, tar, unif(rand));
+  const uint32_t m = edges.size();
+  const float alpha = 0.05f;
+
+  for (const std::string method : {"FDR", "FWER", "FPR"}) {
+    // every edge sorted by MI; the kept edges are the prefix up to the last
+    // that passes
+    std::vector<network_edge> sorted = edges;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const network_edge &rtm1, const network_edge &rtm2) {
+                return std::get<2>(rtm1) > std::get<2>(rtm2);
+              });
+    uint32_t argmax_k = 0U;
+    for (uint32_t k = 0U; k < m; ++k) {
+      const float p_k = nullmodel.getMIPVal(std::get<2>(sorted[k]));
+      if (p_k < (method == "FDR"    ? k * alpha / m
+                 : method == "FWER" ? alpha / m
+                                    : alpha))
+        argmax_k = k + 1U;
+    }
+    sorted.resize(argmax_k);
+    const std::set<std::pair<gene_id, gene_id>> expected =
+        edgeSet(CSRNetwork(sorted, num_genes));
+    ASSERT_GT(expected.size(), 0U) << method;
+    ASSERT_LT(expected.size(), m) << method;
+
+    prune_alpha_stats stats;
+    const CSRNetwork pruned =
+        pruneAlpha(edges, num_genes, m, method, alpha, nullmodel, 4U, stats);
+    EXPECT_EQ(pruned.size(), argmax_k) << method;
+    EXPECT_EQ(edgeSet(pruned), expected) << method;
+  }
+}
+
+// pruneMaxEnt removes what a plain triangle-by-triangle DPI removes, even when
+// the OpenMP team is smaller than the threads asked for
+TEST(AlgorithmsTest, PruneMaxEntMatchesReferenceDPI) {
+  std::mt19937 rand{5};
+  std::uniform_real_distribution<float> unif(0.0f, 1.0f);
+  const gene_id num_regs = 8U, num_genes = 40U;
+  geneset regulators;
+  std::map<std::pair<gene_id, gene_id>, float> mi_of;
+  for (gene_id reg = 0U; reg < num_regs; ++reg) {
+    regulators.insert(reg);
+    for (gene_id tar = 0U; tar < num_genes; ++tar)
+      if (tar != reg && unif(rand) < 0.6f) {
+        // reg-reg edges come in both directions, with the same MI
+        if (tar < num_regs && tar < reg)
+          continue;
+        const float mi = unif(rand);
+        mi_of[{reg, tar}] = mi;
+        if (tar < num_regs)
+          mi_of[{tar, reg}] = mi;
+      }
+  }
+  std::vector<network_edge> edges;
+  for (const auto &[reg_tar, mi] : mi_of)
+    edges.emplace_back(reg_tar.first, reg_tar.second, mi);
+  const CSRNetwork network(edges, num_genes);
+
+  // weakest edge of each triangle, or the reg-reg edge if it is not strictly
+  // stronger than both
+  std::set<std::pair<gene_id, gene_id>> expected = edgeSet(network);
+  for (gene_id reg1 = 0U; reg1 < num_regs; ++reg1)
+    for (gene_id reg2 = reg1 + 1U; reg2 < num_regs; ++reg2) {
+      if (!mi_of.count({reg1, reg2}))
+        continue;
+      const float mi_regs = mi_of[{reg1, reg2}];
+      for (gene_id tar = 0U; tar < num_genes; ++tar) {
+        if (!mi_of.count({reg1, tar}) || !mi_of.count({reg2, tar}))
+          continue;
+        const float mi1 = mi_of[{reg1, tar}], mi2 = mi_of[{reg2, tar}];
+        if (mi1 < mi_regs && mi1 < mi2)
+          expected.erase({reg1, tar});
+        else if (mi2 < mi_regs && mi2 < mi1)
+          expected.erase({reg2, tar});
+        else {
+          expected.erase({reg1, reg2});
+          expected.erase({reg2, reg1});
+        }
+      }
+    }
+  ASSERT_LT(expected.size(), network.size());
+
+  prune_MaxEnt_stats stats;
+  EXPECT_EQ(edgeSet(pruneMaxEnt(network, regulators, 4U, stats)), expected);
+
+  // with no nested parallelism, a team inside a team has one thread
+  const int max_active_levels = omp_get_max_active_levels();
+  omp_set_max_active_levels(1);
+  std::set<std::pair<gene_id, gene_id>> capped;
+#pragma omp parallel num_threads(2)
+#pragma omp single
+  capped = edgeSet(pruneMaxEnt(network, regulators, 4U, stats));
+  omp_set_max_active_levels(max_active_levels);
+  EXPECT_EQ(capped, expected);
+}
+
+TEST(AlgorithmsTest, SubnetAccumulatorCountsEdgeOccurrences) {
+  SubnetAccumulator accumulated;
+  accumulated.add(CSRNetwork({{2, 7, 0.5f}, {2, 1, 0.2f}, {0, 3, 0.1f}}, 4U),
+                  0.25f, 1U);
+  accumulated.add(CSRNetwork({{2, 4, 0.4f}, {2, 7, 0.6f}}, 3U), 0.75f, 1U);
+
+  EXPECT_EQ(accumulated.numSubnets(), 2U);
+  EXPECT_EQ(accumulated.FPREstimate(), 0.5f);
+  const std::vector<gene_id> row2 = {1, 4, 7};
+  const std::vector<uint16_t> counts2 = {1, 1, 2};
+  EXPECT_EQ(accumulated.rowTargets(2), row2);
+  EXPECT_EQ(accumulated.rowCounts(2), counts2);
+  EXPECT_TRUE(accumulated.rowTargets(9).empty());
+  EXPECT_EQ(accumulated.minRegulonSize(), 1U);
+}
+
+TEST(AlgorithmsTest, SubsampleRanksMatchReRankingSubsample) {
+  std::mt19937 rand{7};
+  std::uniform_real_distribution<float> unif(0.0f, 1.0f);
+  const uint16_t n = 50U, n_sub = 31U;
+  std::vector<std::vector<float>> exp_mat(3U, std::vector<float>(n));
+  gene_to_shorts order_mat;
+  for (auto &expr_vec : exp_mat) {
+    for (float &x : expr_vec)
+      x = unif(rand);
+    order_mat.push_back(rankIndices(expr_vec, rand));
+  }
+
+  // the same draws pick the fold that sampleExpMatAndReCopulaTransform uses
+  std::mt19937 sample_rand{11}, fold_rand{11};
+  const gene_to_shorts subsample_ranks_mat =
+      sampleExpMatAndReCopulaTransform(order_mat, n_sub, sample_rand);
+  std::vector<uint16_t> idxs(n), fold(n_sub);
+  std::iota(idxs.begin(), idxs.end(), 0U);
+  std::sample(idxs.begin(), idxs.end(), fold.begin(), n_sub, fold_rand);
+
+  for (size_t gene = 0U; gene < exp_mat.size(); ++gene) {
+    std::vector<float> subsample_vec(n_sub);
+    for (uint16_t i = 0U; i < n_sub; ++i)
+      subsample_vec[i] = exp_mat[gene][fold[i]];
+    const std::vector<uint16_t> idx_ranks = rankIndices(subsample_vec, rand);
+    for (uint16_t r = 0U; r < n_sub; ++r)
+      EXPECT_EQ(subsample_ranks_mat[gene][idx_ranks[r]], r + 1);
+  }
+}